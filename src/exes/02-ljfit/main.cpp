@@ -19,11 +19,24 @@ const char DESCRIPTION[] = "Plots fitted LJ potential.";
 
 using namespace std;
 
+// METHOD argument -> LJFitMethod; returns false for an unknown name
+bool parse_method(const string & name, LJFitMethod & method)
+{
+	if      (name == "linear")              method = LJFitMethod::Linear;
+	else if (name == "gauss-newton")        method = LJFitMethod::GaussNewton;
+	else if (name == "levenberg-marquardt") method = LJFitMethod::LevenbergMarquardt;
+	else if (name == "hybrid")              method = LJFitMethod::Hybrid;
+	else return false;
+	return true;
+}
+
 int main(int argc, char * argv[])
 {
-	if (argc != 6) {
+	LJFitMethod method = LJFitMethod::GaussNewton;
+	if ((argc != 6 && argc != 7) || (argc == 7 && !parse_method(argv[6], method))) {
 		cerr << argv[0] << ": " << DESCRIPTION << endl;
-		cerr << "Usage: " << argv[0] << "  N_SAMPLE  N_IMAGE  FIT_LB  FIT_UB  ZPOS" << endl;
+		cerr << "Usage: " << argv[0] << "  N_SAMPLE  N_IMAGE  FIT_LB  FIT_UB  ZPOS  [METHOD]" << endl;
+		cerr << "METHOD is one of linear, gauss-newton (default), levenberg-marquardt, hybrid" << endl;
 		return 1;
 	}
 
@@ -49,35 +62,27 @@ int main(int argc, char * argv[])
 		.set_upper_coords(1., 1., arg_ub)
 	;
 
-	for (std::size_t i=0; i < data.axis_size(1); i++) {
-		for (std::size_t j=0; j < data.axis_size(2); j++) {
-			for (std::size_t k=0; k < data.axis_size(3); k++) {
-				double x = data.coord(1,i);
-				double y = data.coord(2,j);
-				double z = data.coord(3,k);
-				data(i, j, k) = lj.value_at(x, y, z);
-			}
-		}
-	}
+	evaluate_on_lattice(lj, data);
 
 	// fit the data
-	LJPseudoPotential<double> fit = LJPseudoPotential<double>::fit_to_data(data);
+	LJPseudoPotential<double> fit = LJPseudoPotential<double>::fit_to_data(data, LJFitOptions<double>().set_method(method));
 
 	size_t imgdim = arg_nimage;
+	auto image = Lattice2<double> {imgdim, imgdim};
+
+	#ifdef PLOT_FIT
+	fit.render_plane(arg_zpos, image);
+	#endif
+
+	#ifdef PLOT_POT
+	for (size_t i=0; i < imgdim; i++)
+		for (size_t j=0; j < imgdim; j++)
+			image(i, j) = lj.value_at(image.coord_0(i), image.coord_1(j), arg_zpos);
+	#endif
+
 	for (size_t i=0; i < imgdim; i++) {
-		for (size_t j=0; j < imgdim; j++) {
-			double x = 1. / (imgdim-1) * i;
-			double y = 1. / (imgdim-1) * j;
-			double z = arg_zpos;
-
-			#ifdef PLOT_FIT
-			cout << fit.value_at(x, y, z) << "\t";
-			#endif
-
-			#ifdef PLOT_POT
-			cout << lj.value_at(x, y, z) << "\t";
-			#endif
-		}
+		for (size_t j=0; j < imgdim; j++)
+			cout << image(i, j) << "\t";
 		cout << endl;
 	}
 	return 0;
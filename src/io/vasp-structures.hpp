@@ -4,6 +4,8 @@
 #include <vector>
 #include <cmath>
 #include <cassert>
+#include <string>
+#include <stdexcept>
 
 #include "../lattice.hpp"
 
@@ -110,7 +112,9 @@ public:
 	//       and especially with the fact that the dynamics flags are not meaningful
 	//       in full dynamics mode), they're not yet fully implemented.
 
-	static constexpr std::array<double,3> DEFAULT_COORDS {{0.,   0.,   0.}};
+	// (a function rather than a static constexpr member, since the latter would need an
+	//  out-of-line definition, which can't live in a header included by several files)
+	static std::array<double,3> default_coords () { return {{0., 0., 0.}}; }
 
 	VaspParticleList ()
 	: _speciesEndpoints(1, 0.) // first element of this must always be 0
@@ -136,7 +140,7 @@ public:
 
 		_speciesEndpoints.push_back(newsize);
 
-		_coords.resize(newsize, DEFAULT_COORDS);
+		_coords.resize(newsize, default_coords());
 
 		assert(size() == newsize);
 		return oldsize; // index of first new particle
@@ -174,10 +178,6 @@ private:
 	// invariant: _speciesEndpoints.back() == size()
 };
 
-// Despite its complete declaration __and__ initialization above, this is required for some reason.
-// dangit c++ y u no sanity
-constexpr std::array<double,3> VaspParticleList::DEFAULT_COORDS;
-
 // Represents a complete LOCPOT file
 // (this is an aggregate type, so it may be initialized using brace syntax)
 struct VaspLocpot {
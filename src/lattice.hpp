@@ -2,6 +2,8 @@
 
 #include <algorithm>
 #include <numeric>
+#include <array>
+#include <vector>
 
 #include "util/all-convertible-to.hpp"
 
@@ -182,7 +184,7 @@ class Lattice {
 			return std::array<OutType, Dim> {{static_cast<OutType>(args)...}};
 		}
 
-		inline size_type flat_index (const std::array<size_type, Dim> & indices) {
+		inline size_type flat_index (const std::array<size_type, Dim> & indices) const {
 			return std::inner_product(
 				indices.begin(),  indices.end(),
 				_strides.begin(),
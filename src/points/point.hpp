@@ -1,5 +1,9 @@
 #pragma once
 
+#include <array>
+#include <vector>
+#include <algorithm>
+
 //--------------------------------------
 // A basis so important we can't declare anything without it!
 class Cartesian { };
@@ -172,7 +176,8 @@ RawPoint transform (const RawPoint & point, const FromBasis & fromBasis, const T
 }
 
 // The Cartesian => Cartesian trivial conversion:
-RawPoint transform (const RawPoint & point, const Cartesian &, const Cartesian &)
+// (inline, so that multiple translation units may include this header)
+inline RawPoint transform (const RawPoint & point, const Cartesian &, const Cartesian &)
 {
 	return point;
 }
@@ -1,6 +1,27 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <utility>
+
+#include "potential-lj/particle-arrays.hpp"
+#include "potential-lj/species-table.hpp"
+#include "potential-lj/mie-shape.hpp"
+#include "potential-lj/kernel.hpp"
+#include "potential-lj/pair-table.hpp"
+#include "potential-lj/cell-list.hpp"
+#include "potential-lj/slab-tail.hpp"
+#include "potential-lj/periodic-cell.hpp"
+#include "potential-lj/column-buffer.hpp"
+#include "potential-lj/octree.hpp"
+#include "io/vasp-structures.hpp"
+#include "points/point-collection.hpp"
+#include "util/parallel.hpp"
+#include "util/space-filling-curve.hpp"
+#include "util/summation.hpp"
+#include "lattice.hpp"
 
 template <class T>
 struct LJParticle {
@@ -18,34 +39,1265 @@ struct LJParticle {
 	{ }
 };
 
+// The energy and vertical force along a vertical line of points, as from a force
+//  spectroscopy experiment: (x, y, z[k]) for each k
 template <class T>
-class LJPotential {
+struct LJZSweep {
+	std::vector<T> z;
+	std::vector<T> energy;
+	std::vector<T> force_z; // -dE/dz
+};
+
+// The potential felt by a probe near a sample of particles, each of which interacts with it
+//  through a Mie (N-M) potential
+//
+//     E = eps / (N-M) * (M (r_m/r)^N - N (r_m/r)^M)
+//
+//  parameterized as for LJ by the well depth eps and the position r_m of the minimum.
+// The exponents are compile-time constants, so each pair gets kernels of its own with no
+//  calls to pow (see potential-lj/mie-shape.hpp).  LJPotential is the 12-6 case.
+// (M must exceed 3, for the tail correction)
+template <class T, int N, int M>
+class MiePotential {
 	public:
+		typedef std::array<T, 3> Vector;
+		typedef MieShape<N, M> Shape;
+		typedef typename LJPairTable<T>::PairFunction PairFunction;
+
+		MiePotential()
+		: image_shifts(1, Vector {{0, 0, 0}})
+		{ }
+
+		// Adds a particle whose interaction with the probe has the given parameters.
+		// (behind the scenes, each distinct pair of parameters becomes a species)
 		void add_particle(T x, T y, T z, T energy_unit, T length_unit)
 		{
-			particles.emplace_back(x, y, z, energy_unit, length_unit);
+			add_particle(x, y, z, species.find_or_add_species(energy_unit, length_unit));
+		}
+
+		void add_particle(const LJParticle<T> & p)
+		{
+			add_particle(p.x, p.y, p.z, p.energy_unit, p.length_unit);
+		}
+
+		// Adds a particle of a species registered with add_species()
+		void add_particle(T x, T y, T z, LJSpeciesIndex s)
+		{
+			if (s >= species.size())
+				throw std::out_of_range("MiePotential: no such species");
+			particles.push_back(x, y, z, s);
+			origin.push_back(origin.size());
+			stale = true;
+		}
+
+		// Adds every particle of a VASP structure.  species_map[k] is the species to use for
+		//  the k-th species of the VaspParticleList, and the coordinates are taken to be
+		//  cartesian.
+		void add_particles(const VaspParticleList & list, const std::vector<LJSpeciesIndex> & species_map)
+		{
+			reserve(size() + list.size());
+			for (std::size_t i=0; i < list.size(); i++) {
+				auto pos = list.coords(i);
+				add_particle(T(pos[0]), T(pos[1]), T(pos[2]), species_map.at(list.species(i)));
+			}
+		}
+
+		//-------------------------------------
+		// Editing
+		// Particles are identified by their index, in the order they were added.
+		// As with add_particle(), call finalize() after editing if a cutoff or far-field
+		//  mode is in use.
+
+		void move_particle(std::size_t i, T x, T y, T z)
+		{
+			check_particle_index(i);
+			particles.set_position(i, x, y, z);
+			stale = true;
+		}
+
+		// The particles after i move down by one index
+		void remove_particle(std::size_t i)
+		{
+			check_particle_index(i);
+			particles.erase(i);
+
+			std::size_t o = origin[i];
+			origin.erase(origin.begin() + i);
+			for (auto & k : origin)
+				if (k > o)
+					k--;
+			stale = true;
+		}
+
+		// These variants also patch a lattice previously filled by evaluate_on_lattice()
+		//  (with the potential as it stood before the edit), by subtracting the particle's old
+		//  contribution and adding its new one.  With a cutoff, only the points within the
+		//  cutoff of the particle (or its periodic images) are touched, plus a cheap
+		//  per-height adjustment for the change to the tail correction; the cost is then
+		//  independent of the size of the sample.  They finalize() as they go.
+		//
+		// The patched lattice agrees with a fresh evaluation to within rounding (relative to
+		//  the size of the terms that were removed).  In far-field mode, the patch uses the
+		//  exact contribution of the edited particle, so the agreement only holds to within
+		//  the far-field tolerance.
+		void add_particle(T x, T y, T z, LJSpeciesIndex s, Lattice3<T> & lattice)
+		{
+			// (a new species may change the table's grid, and with it every point)
+			if (has_tabulation() && species.size() != table.species_count())
+				throw std::logic_error("MiePotential: species were added since the table was built; call finalize() and re-evaluate the lattice");
+			edit_with_lattice(lattice, [&] () {
+				add_particle(x, y, z, s);
+				add_particle_to_lattice(lattice, x, y, z, s, T(1));
+			});
+		}
+
+		void add_particle(T x, T y, T z, T energy_unit, T length_unit, Lattice3<T> & lattice)
+		{
+			// (refused before the species is added, so that the table is left as it was)
+			if (has_tabulation() && !species.contains(energy_unit, length_unit))
+				throw std::logic_error("MiePotential: a new species would change the table; add it, call finalize() and re-evaluate the lattice");
+			add_particle(x, y, z, species.find_or_add_species(energy_unit, length_unit), lattice);
+		}
+
+		void move_particle(std::size_t i, T x, T y, T z, Lattice3<T> & lattice)
+		{
+			check_particle_index(i);
+			edit_with_lattice(lattice, [&] () {
+				LJSpeciesIndex s = particles.species()[i];
+				add_particle_to_lattice(lattice, particles.x()[i], particles.y()[i], particles.z()[i], s, T(-1));
+				move_particle(i, x, y, z);
+				add_particle_to_lattice(lattice, x, y, z, s, T(1));
+			});
+		}
+
+		void remove_particle(std::size_t i, Lattice3<T> & lattice)
+		{
+			check_particle_index(i);
+			edit_with_lattice(lattice, [&] () {
+				LJSpeciesIndex s = particles.species()[i];
+				add_particle_to_lattice(lattice, particles.x()[i], particles.y()[i], particles.z()[i], s, T(-1));
+				remove_particle(i);
+			});
+		}
+
+		// Avoids repeated reallocation when the particle count is known in advance
+		void reserve(std::size_t n)
+		{
+			this->particles.reserve(n);
+			origin.reserve(n);
 		}
 
+		// Sorts the particles along a space-filling curve through their bounding box, so
+		//  that particles near each other in space are near each other in memory.  Inputs
+		//  tend to come grouped by species (as VASP files are) rather than by position, which
+		//  leaves every pass that walks the particles spatially (building the cell list and
+		//  octree, patching lattices) jumping all over memory.
+		// This renumbers the particles; original_index() maps back.  Results change only by
+		//  rounding, as the terms are summed in a different order.  Finalizes.
+		MiePotential & reorder(SpaceFillingCurve curve = SpaceFillingCurve::Hilbert)
+		{
+			std::size_t n = particles.size();
+			if (n > 1) {
+				T lower[3], extent = 0;
+				const typename LJParticleArrays<T>::array_type * axes[3] = { &particles.x(), &particles.y(), &particles.z() };
+				for (int a=0; a<3; a++) {
+					auto minmax = std::minmax_element(axes[a]->begin(), axes[a]->end());
+					lower[a] = *minmax.first;
+					extent = std::max(extent, *minmax.second - *minmax.first);
+				}
+
+				// (cubic cells, so that the curve treats the axes alike)
+				T scale = (extent > 0)? T((std::uint32_t(1) << CURVE_BITS) - 1) / extent : T(0);
+				std::vector<std::pair<std::uint64_t, std::size_t>> keys(n);
+				for (std::size_t i=0; i < n; i++) {
+					std::uint32_t cell[3];
+					for (int a=0; a<3; a++)
+						cell[a] = std::uint32_t(((*axes[a])[i] - lower[a]) * scale);
+					keys[i] = std::make_pair(curve_key(curve, cell[0], cell[1], cell[2]), i);
+				}
+				std::sort(keys.begin(), keys.end());
+
+				std::vector<std::size_t> order(n);
+				std::vector<std::size_t> new_origin(n);
+				for (std::size_t k=0; k < n; k++) {
+					order[k] = keys[k].second;
+					new_origin[k] = origin[order[k]];
+				}
+				particles.permute(order);
+				origin.swap(new_origin);
+			}
+
+			finalize();
+			return *this;
+		}
+
+		// The index particle i would have if reorder() had never been called: its position
+		//  in the order the particles were added (counting only those not since removed).
+		std::size_t original_index(std::size_t i) const
+		{
+			check_particle_index(i);
+			return origin[i];
+		}
+
+		const std::vector<std::size_t> & original_indices() const { return origin; }
+
 		std::size_t size() const { return this->particles.size(); }
 
+		//-------------------------------------
+		// Species
+		// (see potential-lj/species-table.hpp)
+
+		// Registers a species with its own LJ parameters, returning its index
+		LJSpeciesIndex add_species(T energy_unit, T length_unit)
+		{
+			return species.add_species(energy_unit, length_unit);
+		}
+
+		// Selects the species of the probe, so that the parameters of each particle come from
+		//  mixing the probe's with those of the particle's species.  Without a probe species,
+		//  every species' own parameters are used as they are.
+		MiePotential & set_probe_species(LJSpeciesIndex probe)
+		{
+			species.set_probe(probe);
+			finalize();
+			return *this;
+		}
+
+		MiePotential & clear_probe_species()
+		{
+			species.clear_probe();
+			finalize();
+			return *this;
+		}
+
+		// Lorentz-Berthelot by default
+		MiePotential & set_mixing_rule(typename LJSpeciesTable<T>::MixingRule rule)
+		{
+			species.set_mixing_rule(rule);
+			finalize();
+			return *this;
+		}
+
+		// Overrides the mixing rule for one pair of species
+		MiePotential & set_pair_parameters(LJSpeciesIndex a, LJSpeciesIndex b, T energy_unit, T length_unit)
+		{
+			species.set_pair(a, b, energy_unit, length_unit);
+			finalize();
+			return *this;
+		}
+
+		const LJSpeciesTable<T> & species_table() const { return species; }
+
+		//-------------------------------------
+		// Cutoff mode
+		// (these use the named parameter idiom, like Lattice's set_lower_coords)
+
+		// Ignores every particle at a distance >= radius from the evaluation point.
+		// Particles are binned into a cell list, so that the cost of an evaluation depends
+		//  on the local density rather than on the size of the sample.
+		// The cell list is built now; if particles are added later, call finalize() again
+		//  before evaluating.  Replaces far-field mode.
+		MiePotential & set_cutoff(T radius)
+		{
+			cutoff_radius = radius;
+			theta = 0;
+			tree = LJOctree<T, Shape>();
+			finalize();
+			return *this;
+		}
+
+		// Chooses the smallest cutoff for which the estimated truncation error (see
+		//  potential-lj/slab-tail.hpp) does not exceed `tolerance` anywhere.  This bounds the
+		//  whole neglected tail, so the estimate holds even with the tail correction disabled.
+		MiePotential & set_cutoff_for_tolerance(T tolerance)
+		{
+			// (the estimate needs only the particles' coefficients and extent, so it is taken
+			//  from them directly, and the rest is built once, at the chosen cutoff)
+			LJSlabTail<T, Shape> estimate;
+			estimate.build(particles, species.probe_row(), lateral_area());
+			return set_cutoff(estimate.cutoff_for(tolerance));
+		}
+
+		// Toggles the analytic mean-field correction for the r^-M attraction beyond the
+		//  cutoff (on by default).
+		MiePotential & set_tail_correction(bool enable)
+		{
+			tail_correction = enable;
+			return *this;
+		}
+
+		// (also ends tabulated mode, which needs the cutoff)
+		MiePotential & clear_cutoff()
+		{
+			cutoff_radius = 0;
+			cells = LJCellList<T>();
+			return clear_tabulation();
+		}
+
+		//-------------------------------------
+		// Summation
+
+		// How value_at() and the lattice methods add up the terms (see util/summation.hpp).
+		// The default, Naive, lets the SIMD kernels keep a partial sum per lane, so its
+		//  rounding depends on the vector width of the build.  Compensated and Pairwise
+		//  instead add the individual terms on the scalar side, in an order fixed by the
+		//  particles and the cell list alone, so their results are bitwise reproducible
+		//  across instruction sets (as well as thread counts, which never affect any of
+		//  the methods).  They are also more accurate for large samples, at some cost in
+		//  speed.  (evaluate() and z_sweep() always sum naively)
+		MiePotential & set_summation(SummationMethod method)
+		{
+			summation = method;
+			return *this;
+		}
+
+		SummationMethod summation_method() const { return summation; }
+
+		//-------------------------------------
+		// Tabulated mode
+
+		// Replaces the pair energy with a cubic spline in r^2, tabulated once per species over
+		//  [r_min^2, cutoff^2] with the given number of intervals (see
+		//  potential-lj/pair-table.hpp).  r_min is half the smallest r_m, which is far up
+		//  the repulsive wall; closer pairs are held at the energy there.
+		// By default the Mie potential itself is tabulated.  Any other pair function
+		//  f(pair parameters, r^2) may be given instead, which then costs the same per pair as
+		//  the table does, however expensive f is.  The tail correction, which models the
+		//  Mie attraction, is not applied to a custom function, and evaluate() (which needs
+		//  derivatives of f) is unavailable with one.
+		// Requires a cutoff.  The table is rebuilt by finalize().
+		// Throws std::invalid_argument (and ends tabulated mode) if the table would be too
+		//  large to index exactly; see LJPairTable::max_coefficients().
+		MiePotential & set_tabulation(std::size_t intervals, PairFunction f = PairFunction())
+		{
+			if (!has_cutoff())
+				throw std::logic_error("MiePotential: tabulation requires a cutoff");
+			if (intervals == 0)
+				throw std::invalid_argument("MiePotential: a table needs at least one interval");
+
+			table_intervals = intervals;
+			pair_function = f;
+			try {
+				finalize();
+			} catch (...) {
+				clear_tabulation();
+				throw;
+			}
+			return *this;
+		}
+
+		// Tabulates with the fewest intervals (doubling from 64) whose measured relative
+		//  error, tabulation_error(), does not exceed `tolerance`.
+		MiePotential & set_tabulation_for_tolerance(T tolerance, PairFunction f = PairFunction())
+		{
+			for (std::size_t intervals = 64; intervals <= MAX_TABLE_INTERVALS; intervals *= 2) {
+				set_tabulation(intervals, f);
+				if (tabulation_error() <= tolerance)
+					return *this;
+			}
+			clear_tabulation();
+			throw std::runtime_error("MiePotential: tabulation tolerance cannot be met");
+		}
+
+		MiePotential & clear_tabulation()
+		{
+			table_intervals = 0;
+			pair_function = PairFunction();
+			table = LJPairTable<T>();
+			return *this;
+		}
+
+		bool has_tabulation() const { return table_intervals > 0; }
+
+		// Largest relative error of the table, as measured when it was built
+		T tabulation_error() const { return table.max_error(); }
+
+		//-------------------------------------
+		// Far-field mode
+
+		// Sums the full potential, but approximates each distant cluster of particles by a
+		//  low-order expansion (Barnes-Hut; see potential-lj/octree.hpp).  A cluster is opened
+		//  whenever its radius exceeds `opening_angle` times its distance from the point, so
+		//  smaller angles trade speed for accuracy (the error of each cluster scales roughly
+		//  as opening_angle^3).
+		// Replaces any cutoff.  As with a cutoff, call finalize() again after adding particles.
+		// The angle must lie in (0, 1): from 1 on, a cluster could be accepted with the point
+		//  inside its bounding sphere, where the expansion diverges.
+		MiePotential & set_far_field(T opening_angle)
+		{
+			if (!(opening_angle > 0 && opening_angle < 1))
+				throw std::invalid_argument("MiePotential: the far-field opening angle must lie in (0, 1)");
+			theta = opening_angle;
+			clear_cutoff();
+			finalize();
+			return *this;
+		}
+
+		MiePotential & clear_far_field()
+		{
+			theta = 0;
+			tree = LJOctree<T, Shape>();
+			return *this;
+		}
+
+		bool has_far_field()   const { return theta > 0; }
+		T    far_field_theta() const { return theta; }
+
+		//-------------------------------------
+		// Periodic mode
+
+		// Treats the particles as one cell of a periodic system with the given lattice
+		//  vectors, periodic along the axes flagged in `periodic` (by default a slab:
+		//  periodic along a and b only).  No replicas are stored.
+		//
+		// With a cutoff, the images that can lie within the cutoff are enumerated exactly for
+		//  each evaluation point (for a cutoff below half the cell width, this reduces to the
+		//  minimum image convention).  Without one, the sum runs over a fixed block of
+		//  (2n+1) images along each periodic axis; see set_image_count().
+		//
+		// The tail correction models the system as a slab lying in the xy plane, so it is
+		//  only applied when exactly a and b are periodic (with c the stacking direction).
+		MiePotential & set_periodic(Vector a, Vector b, Vector c, std::array<bool, 3> periodic = {{true, true, false}})
+		{
+			cell = LJPeriodicCell<T>(a, b, c, periodic);
+			compute_image_shifts();
+			finalize();
+			return *this;
+		}
+
+		// Uses the (scaled) lattice vectors of a VASP cell
+		MiePotential & set_periodic(const VaspLatticeCell & vasp, std::array<bool, 3> periodic = {{true, true, false}})
+		{
+			Vector v[3];
+			for (int i=0; i<3; i++)
+				for (int k=0; k<3; k++)
+					v[i][k] = T(vasp.scale() * vasp.vector(i)[k]);
+			return set_periodic(v[0], v[1], v[2], periodic);
+		}
+
+		// Number of images on either side of the home cell, along each periodic axis, that
+		//  are summed when there is no cutoff.  Defaults to 1 (a 3x3 block for a slab).
+		MiePotential & set_image_count(unsigned n)
+		{
+			image_count = n;
+			compute_image_shifts();
+			return *this;
+		}
+
+		MiePotential & clear_periodic()
+		{
+			cell = LJPeriodicCell<T>();
+			compute_image_shifts();
+			finalize();
+			return *this;
+		}
+
+		bool is_periodic() const { return cell.any_periodic(); }
+
+		//-------------------------------------
+
+		bool has_cutoff() const { return cutoff_radius > 0; }
+		T    cutoff()     const { return cutoff_radius; }
+
+		// Estimated worst-case magnitude of the energy neglected by a given cutoff
+		T truncation_error_bound(T radius) const { return tail.bound(radius); }
+
+		// Rebuilds the data structures derived from the particle list and parameters (the
+		//  cell list or octree, and the tail correction's density).  Must be called after
+		//  add_particle() if a cutoff or far-field mode is in use.
+		void finalize()
+		{
+			tail.build(particles, species.probe_row(), lateral_area());
+			if (is_periodic())
+				compute_fractional_bounds();
+			if (has_cutoff())
+				cells.build(particles, cell_size());
+			if (has_far_field())
+				tree.build(particles, species.probe_row(), OCTREE_LEAF);
+			if (has_tabulation())
+				build_table();
+			stale = false;
+		}
+
+		//-------------------------------------
+		// Evaluation
+
+		// Uses the SIMD kernel when one is compiled in; see potential-lj/kernel.hpp for
+		//  the accuracy guarantee relative to a plain serial loop (and set_summation() for
+		//  other ways to add up the terms).
 		T value_at(T x, T y, T z) const
 		{
-			T result = 0.0;
-			for (auto particle : this->particles) {
-				T delta_x = x - particle.x;
-				T delta_y = y - particle.y;
-				T delta_z = z - particle.z;
+			const LJPairTable<T> * terms_table = has_tabulation()? &table : nullptr;
+			Accumulator<T> sum(summation);
+			if (has_far_field()) {
+				for_each_far_field_interaction(x, y, z,
+					[&] (const LJParticleSpan<T> & span, T sx, T sy, T sz) { add_energies(span, sx, sy, sz, T(0), terms_table, sum); },
+					[&] (const LJCluster<T, Shape> & cluster, T sx, T sy, T sz)   { sum.add(cluster.energy(sx, sy, sz)); }
+				);
+			} else {
+				T cutoff_sq = has_cutoff()? cutoff_radius * cutoff_radius : T(0);
+				for_each_interaction(x, y, z, [&] (const LJParticleSpan<T> & span, T sx, T sy, T sz) {
+					add_energies(span, sx, sy, sz, cutoff_sq, terms_table, sum);
+				});
+			}
+
+			T result = sum.result();
+			if (applies_tail())
+				result += tail.energy(z, cutoff_radius);
+			return result;
+		}
+
+		// Energy, force, and (if requested) Hessian at a point, computed together in a single
+		//  pass over the particles.  This is far cheaper than numerically differentiating
+		//  value_at, which needs 4 evaluations per derivative.
+		// Agrees with value_at on the energy to within a few ulp per term.
+		// (always analytic, even in tabulated mode; unavailable with a custom pair function)
+		LJEvaluation<T> evaluate(T x, T y, T z, bool with_hessian=false) const
+		{
+			if (pair_function)
+				throw std::logic_error("MiePotential: evaluate() is unavailable with a custom pair function");
+
+			T cutoff_sq = has_cutoff()? cutoff_radius * cutoff_radius : T(0);
 
-				T delta_r2 = delta_x*delta_x + delta_y*delta_y + delta_z*delta_z;
-				T r_minus2 = (particle.length_unit * particle.length_unit) / delta_r2;
+			auto row = species.probe_row();
 
-				T r_minus6  = r_minus2 * r_minus2 * r_minus2;
+			LJEvaluation<T> result = LJEvaluation<T>::zero();
+			auto exact = [&] (const LJParticleSpan<T> & span, T sx, T sy, T sz) {
+				LJKernel<T, Shape>::evaluate(span, row, sx, sy, sz, cutoff_sq, with_hessian, result);
+			};
 
-				result += particle.energy_unit * (r_minus6 - 2.0) * r_minus6;
+			if (has_far_field()) {
+				for_each_far_field_interaction(x, y, z, exact, [&] (const LJCluster<T, Shape> & cluster, T sx, T sy, T sz) {
+					cluster.evaluate(sx, sy, sz, with_hessian, result);
+				});
+			} else {
+				for_each_interaction(x, y, z, exact);
+			}
+
+			if (applies_tail()) {
+				result.energy   += tail.energy(z, cutoff_radius);
+				result.force[2] -= tail.derivative(z, cutoff_radius);
+				if (with_hessian)
+					result.hessian[2][2] += tail.second_derivative(z, cutoff_radius);
 			}
 			return result;
 		}
 
+		std::array<T, 3> force_at(T x, T y, T z) const { return evaluate(x, y, z).force; }
+
+		// Evaluates the potential at n points, writing the results to out[0..n).
+		// Equivalent to calling value_at on each point, but blocked so that a tile of
+		//  particles stays resident in L1 while a whole block of points is processed,
+		//  rather than streaming the full particle list from memory once per point.
+		void value_at_many(const T * xs, const T * ys, const T * zs, std::size_t n, T * out) const
+		{
+			if (has_cutoff() || has_far_field() || summation != SummationMethod::Naive) {
+				// The cell list or octree already confines each evaluation to what matters
+				// (and the other summation methods go term by term anyway)
+				for (std::size_t j=0; j < n; j++)
+					out[j] = value_at(xs[j], ys[j], zs[j]);
+				return;
+			}
+
+			auto all = this->particles.span();
+			auto row = species.probe_row();
+
+			std::fill(out, out + n, T(0));
+			for (std::size_t pbegin=0; pbegin < n; pbegin += POINT_BLOCK) {
+				std::size_t pend = std::min(pbegin + POINT_BLOCK, n);
+
+				for (std::size_t begin=0; begin < all.size; begin += PARTICLE_TILE) {
+					auto tile = all.subspan(begin, std::min(begin + PARTICLE_TILE, all.size));
+
+					for (std::size_t j=pbegin; j < pend; j++)
+						for (auto & t : image_shifts)
+							out[j] += LJKernel<T, Shape>::energy(tile, row, xs[j] - t[0], ys[j] - t[1], zs[j] - t[2]);
+				}
+			}
+		}
+
+		// PointCollection version of value_at_many.  `out` is resized to match `points`.
+		void evaluate_into(const PointCollection<Cartesian> & points, std::vector<T> & out) const
+		{
+			std::size_t n = points.size();
+
+			// deinterleave into the SoA form expected by value_at_many
+			std::vector<T> xs(n), ys(n), zs(n);
+			for (std::size_t j=0; j < n; j++) {
+				xs[j] = points[j].first();
+				ys[j] = points[j].second();
+				zs[j] = points[j].third();
+			}
+
+			out.resize(n);
+			value_at_many(xs.data(), ys.data(), zs.data(), n, out.data());
+		}
+
+		std::vector<T> value_at_many(const PointCollection<Cartesian> & points) const
+		{
+			std::vector<T> out;
+			evaluate_into(points, out);
+			return out;
+		}
+
+		// Energy and vertical force at n heights evenly spaced from z_begin to z_end
+		//  (inclusive), above the point (x, y).
+		// Far cheaper than calling evaluate() at each height: as in evaluate_on_lattice, the
+		//  lateral distance to each particle is computed once for the whole line, and each
+		//  height then costs a single z difference per particle.  Agrees with evaluate() to
+		//  within rounding.  (like evaluate(), this is always analytic, and is unavailable
+		//  with a custom pair function)
+		LJZSweep<T> z_sweep(T x, T y, T z_begin, T z_end, std::size_t n) const
+		{
+			std::vector<T> zs(n);
+			for (std::size_t k=0; k < n; k++)
+				zs[k] = (n == 1)? z_begin : z_begin + (z_end - z_begin) * T(k) / T(n - 1);
+			return z_sweep(x, y, zs);
+		}
+
+		// Likewise, at arbitrary heights
+		LJZSweep<T> z_sweep(T x, T y, const std::vector<T> & zs) const
+		{
+			if (pair_function)
+				throw std::logic_error("MiePotential: z_sweep() is unavailable with a custom pair function");
+			require_finalized();
+
+			LJZSweep<T> result;
+			result.z = zs;
+			result.energy.assign(zs.size(), T(0));
+			result.force_z.assign(zs.size(), T(0));
+			if (zs.empty())
+				return result;
+
+			if (has_far_field()) {
+				for (std::size_t k=0; k < zs.size(); k++) {
+					LJEvaluation<T> e = evaluate(x, y, zs[k]);
+					result.energy[k]  = e.energy;
+					result.force_z[k] = e.force[2];
+				}
+				return result;
+			}
+
+			T cutoff_sq = has_cutoff()? cutoff_radius * cutoff_radius : T(0);
+			LJColumnBuffer<T> buffer;
+			for_each_column_tile(x, y, zs, buffer, [&] (const LJColumnSpan<T> & span) {
+				for (std::size_t k=0; k < zs.size(); k++)
+					LJKernel<T, Shape>::column_evaluate(span, zs[k], cutoff_sq, result.energy[k], result.force_z[k]);
+			});
+
+			if (applies_tail()) {
+				for (std::size_t k=0; k < zs.size(); k++) {
+					result.energy[k]  += tail.energy(zs[k], cutoff_radius);
+					result.force_z[k] -= tail.derivative(zs[k], cutoff_radius);
+				}
+			}
+			return result;
+		}
+
+		// Fills every point of a lattice with the potential, taking the lattice's three axes
+		//  as cartesian x, y and z.  Agrees with value_at to within rounding (the terms are
+		//  summed in a different order).
+		//
+		// This is far cheaper than calling value_at for each point.  The lattice is processed
+		//  one column of points along z at a time: each particle's lateral distance to the
+		//  column is computed once (and with a cutoff, particles that are laterally out of
+		//  range are dropped altogether), after which each point of the column costs a single
+		//  z difference per particle.
+		// Columns are shared out among `threads` threads (0 = one per hardware thread).  Each
+		//  column is summed by a single thread, so the result does not depend on the thread count.
+		void evaluate_on_lattice(Lattice3<T> & lattice, unsigned threads=0) const
+		{
+			require_finalized();
+
+			std::vector<T> xs = axis_coords(lattice, 0);
+			std::vector<T> ys = axis_coords(lattice, 1);
+			std::vector<T> zs = axis_coords(lattice, 2);
+			if (xs.empty() || ys.empty() || zs.empty())
+				return;
+
+			std::size_t ncolumns = xs.size() * ys.size();
+			std::size_t nblocks = (ncolumns + COLUMN_BLOCK - 1) / COLUMN_BLOCK;
+
+			parallel_for(nblocks, threads, [&] (std::size_t block) {
+				LJColumnBuffer<T> buffer;
+				std::vector<T> energies(zs.size());
+
+				std::size_t end = std::min((block + 1) * COLUMN_BLOCK, ncolumns);
+				for (std::size_t c = block * COLUMN_BLOCK; c < end; c++) {
+					std::size_t i = c / ys.size();
+					std::size_t j = c % ys.size();
+
+					evaluate_column(xs[i], ys[j], zs, buffer, energies);
+					for (std::size_t k=0; k < zs.size(); k++)
+						lattice(i, j, k) = energies[k];
+				}
+			});
+		}
+
+		// Fills lattices[k] with the potential felt by a probe of species probes[k], for
+		//  several probes at once.  Equivalent to calling evaluate_on_lattice with each
+		//  probe selected in turn (and bitwise identical to it, outside of tabulated mode),
+		//  but the particles near each column are gathered once and then swept for every
+		//  probe while they are still in L1, so that the sample is streamed from memory once
+		//  rather than once per probe.
+		// The lattices must all have the same axes.  Always analytic, like evaluate(), and
+		//  unavailable with a custom pair function or in far-field mode (whose clusters are
+		//  built for a single probe).
+		void evaluate_on_lattices(const std::vector<LJSpeciesIndex> & probes, std::vector<Lattice3<T>> & lattices, unsigned threads=0) const
+		{
+			if (lattices.size() != probes.size())
+				throw std::invalid_argument("MiePotential: need one lattice per probe");
+			if (pair_function)
+				throw std::logic_error("MiePotential: multi-probe evaluation is unavailable with a custom pair function");
+			if (has_far_field())
+				throw std::logic_error("MiePotential: multi-probe evaluation is unavailable in far-field mode");
+			require_finalized();
+			if (probes.empty())
+				return;
+
+			std::vector<T> xs = axis_coords(lattices[0], 0);
+			std::vector<T> ys = axis_coords(lattices[0], 1);
+			std::vector<T> zs = axis_coords(lattices[0], 2);
+			for (auto & lattice : lattices)
+				if (axis_coords(lattice, 0) != xs || axis_coords(lattice, 1) != ys || axis_coords(lattice, 2) != zs)
+					throw std::invalid_argument("MiePotential: the lattices must share their axes");
+			if (xs.empty() || ys.empty() || zs.empty())
+				return;
+
+			// The parameters (and tail correction) as seen by each probe
+			std::size_t nprobes = probes.size();
+			std::vector<LJSpeciesTable<T>> tables(nprobes, species);
+			std::vector<LJPairRow<T>> rows;
+			std::vector<LJSlabTail<T, Shape>> tails(nprobes);
+			for (std::size_t p=0; p < nprobes; p++) {
+				tables[p].set_probe(probes[p]);
+				rows.push_back(tables[p].probe_row());
+				tails[p].build(particles, rows[p], lateral_area());
+			}
+
+			T cutoff_sq = has_cutoff()? cutoff_radius * cutoff_radius : T(0);
+			std::size_t ncolumns = xs.size() * ys.size();
+			std::size_t nblocks = (ncolumns + COLUMN_BLOCK - 1) / COLUMN_BLOCK;
+
+			parallel_for(nblocks, threads, [&] (std::size_t block) {
+				LJColumnBuffer<T> buffer;
+				std::vector<std::vector<Accumulator<T>>> energies(nprobes);
+
+				std::size_t end = std::min((block + 1) * COLUMN_BLOCK, ncolumns);
+				for (std::size_t c = block * COLUMN_BLOCK; c < end; c++) {
+					std::size_t i = c / ys.size();
+					std::size_t j = c % ys.size();
+
+					for (auto & e : energies)
+						e.assign(zs.size(), Accumulator<T>(summation));
+					for_each_column_tile(xs[i], ys[j], zs, buffer, [&] (const LJColumnSpan<T> & span) {
+						for (std::size_t p=0; p < nprobes; p++) {
+							buffer.restage(rows[p]);
+							if (summation == SummationMethod::Naive)
+								for (std::size_t k=0; k < zs.size(); k++)
+									energies[p][k].add(LJKernel<T, Shape>::column_energy(span, zs[k], cutoff_sq));
+							else
+								add_column_terms(span, zs, cutoff_sq, nullptr, energies[p]);
+						}
+					});
+
+					for (std::size_t p=0; p < nprobes; p++) {
+						for (std::size_t k=0; k < zs.size(); k++) {
+							T tail_energy = applies_tail()? tails[p].energy(zs[k], cutoff_radius) : T(0);
+							lattices[p](i, j, k) = energies[p][k].result() + tail_energy;
+						}
+					}
+				}
+			});
+		}
+
+		// Read-only access to the structure-of-arrays storage
+		const LJParticleArrays<T> & particle_arrays() const { return this->particles; }
+
 	private:
-		std::vector<LJParticle<T>> particles;
+		// Blocking parameters for value_at_many.  A tile of 512 particles occupies
+		//  5 * 512 * sizeof(double) = 20kB, comfortably inside a 32kB L1.
+		static const std::size_t PARTICLE_TILE = 512;
+		static const std::size_t POINT_BLOCK   = 64;
+
+		// Lattice columns handed to a thread at a time by evaluate_on_lattice
+		static const std::size_t COLUMN_BLOCK  = 16;
+
+		// Largest octree leaf in far-field mode; a few SIMD widths
+		static const std::size_t OCTREE_LEAF   = 32;
+
+		// Terms computed at a time when summing term by term (on the stack)
+		static const std::size_t TERM_CHUNK    = 256;
+
+		// Finest table tried by set_tabulation_for_tolerance (2MB per species for doubles)
+		static const std::size_t MAX_TABLE_INTERVALS = std::size_t(1) << 16;
+
+		// Cells half as wide as the cutoff, so that the visited block of cells hugs the
+		//  cutoff sphere a bit more tightly than a 3x3x3 block of full-width cells would.
+		T cell_size() const { return cutoff_radius / 2; }
+
+		// The tail correction only describes the Mie attraction
+		bool applies_tail() const { return has_cutoff() && tail_correction && !pair_function; }
+
+		void build_table()
+		{
+			if (species.size() == 0) {
+				table = LJPairTable<T>();
+				return;
+			}
+
+			T r_min = cutoff_radius;
+			for (std::size_t s=0; s < species.size(); s++)
+				r_min = std::min(r_min, species.with_probe(LJSpeciesIndex(s)).length_unit);
+			r_min /= 2;
+
+			PairFunction f = pair_function;
+			if (!f)
+				f = [] (const LJParameters<T> & p, T u) { return Shape::term(p.energy_unit, p.length_unit * p.length_unit, u); };
+			table.build(species, f, r_min * r_min, cutoff_radius * cutoff_radius, table_intervals);
+		}
+
+		// Lateral area for the tail correction's density: the periodic cell's ab face for a
+		//  slab, or else the particles' bounding box.  (0 disables the correction)
+		T lateral_area() const
+		{
+			if (is_periodic()) {
+				if (cell.periodic(0) && cell.periodic(1) && !cell.periodic(2))
+					return cell.face_area(2);
+				return 0;
+			}
+
+			if (particles.size() == 0)
+				return 0;
+			auto xs = std::minmax_element(particles.x().begin(), particles.x().end());
+			auto ys = std::minmax_element(particles.y().begin(), particles.y().end());
+			return (*xs.second - *xs.first) * (*ys.second - *ys.first);
+		}
+
+		// Calls f(span, x', y', z') for every block of particles that may interact with the
+		//  point (x,y,z), where (x',y',z') is the point shifted into the frame of whichever
+		//  periodic image of the block is being considered.  Every kernel goes through here,
+		//  so that all of them sum the contributions in the same order.
+		//
+		// Without a cutoff, the blocks are L1-sized tiles of the particle arrays (summed tile
+		//  by tile, in the same order as value_at_many, so the two agree bitwise), each visited
+		//  once per image.  With a cutoff, they are columns from the cell list, for each image
+		//  that can reach the cutoff sphere.
+		// (far-field mode has its own counterpart, below)
+		template <class F>
+		void for_each_interaction(T x, T y, T z, F && f) const
+		{
+			if (!has_cutoff()) {
+				auto all = this->particles.span();
+				for (std::size_t begin=0; begin < all.size; begin += PARTICLE_TILE) {
+					auto tile = all.subspan(begin, std::min(begin + PARTICLE_TILE, all.size));
+					for (auto & t : image_shifts)
+						f(tile, x - t[0], y - t[1], z - t[2]);
+				}
+				return;
+			}
+
+			require_finalized();
+
+			// Images of the sample that can reach the cutoff sphere
+			// (just the sample itself when not periodic)
+			Vector frac = cell.fractional(Vector {{x, y, z}});
+			long first[3], last[3];
+			for (int a=0; a<3; a++)
+				cell.image_range(a, frac[a], cutoff_radius, fractional_lo[a], fractional_hi[a], first[a], last[a]);
+
+			for (long n0=first[0]; n0 <= last[0]; n0++) {
+				for (long n1=first[1]; n1 <= last[1]; n1++) {
+					for (long n2=first[2]; n2 <= last[2]; n2++) {
+						// evaluate the unshifted sample at a shifted point
+						Vector t = cell.translation(n0, n1, n2);
+						T sx = x - t[0], sy = y - t[1], sz = z - t[2];
+
+						cells.for_each_span_near(sx, sy, sz, cutoff_radius, [&] (const LJParticleSpan<T> & span) {
+							f(span, sx, sy, sz);
+						});
+					}
+				}
+			}
+		}
+
+		// Energies at the points (x, y, zs[k]), written to out[k]
+		void evaluate_column(T x, T y, const std::vector<T> & zs, LJColumnBuffer<T> & buffer, std::vector<T> & out) const
+		{
+			if (has_far_field()) {
+				// which clusters get opened differs from point to point
+				for (std::size_t k=0; k < zs.size(); k++)
+					out[k] = value_at(x, y, zs[k]);
+				return;
+			}
+
+			T cutoff_sq = has_cutoff()? cutoff_radius * cutoff_radius : T(0);
+
+			if (summation == SummationMethod::Naive) {
+				std::fill(out.begin(), out.end(), T(0));
+				for_each_column_tile(x, y, zs, buffer, [&] (const LJColumnSpan<T> & span) {
+					if (has_tabulation())
+						for (std::size_t k=0; k < zs.size(); k++)
+							out[k] += LJKernel<T, Shape>::column_energy_table(span, table, zs[k], cutoff_sq);
+					else
+						for (std::size_t k=0; k < zs.size(); k++)
+							out[k] += LJKernel<T, Shape>::column_energy(span, zs[k], cutoff_sq);
+				});
+			} else {
+				std::vector<Accumulator<T>> sums(zs.size(), Accumulator<T>(summation));
+				for_each_column_tile(x, y, zs, buffer, [&] (const LJColumnSpan<T> & span) {
+					add_column_terms(span, zs, cutoff_sq, has_tabulation()? &table : nullptr, sums);
+				});
+				for (std::size_t k=0; k < zs.size(); k++)
+					out[k] = sums[k].result();
+			}
+
+			if (applies_tail())
+				for (std::size_t k=0; k < zs.size(); k++)
+					out[k] += tail.energy(zs[k], cutoff_radius);
+		}
+
+		// Adds the energy of the particles of `span` at the point (x, y, z) to `sum`: as a
+		//  single total from the SIMD kernels when summing naively, and otherwise term by term.
+		// Looks the terms up in `terms_table` if it is not null.  A cutoff_sq of 0 means no cutoff.
+		void add_energies(const LJParticleSpan<T> & span, T x, T y, T z, T cutoff_sq, const LJPairTable<T> * terms_table, Accumulator<T> & sum) const
+		{
+			auto row = species.probe_row();
+			if (sum.method() == SummationMethod::Naive) {
+				if (terms_table)
+					sum.add(LJKernel<T, Shape>::energy_table(span, *terms_table, x, y, z, cutoff_sq));
+				else if (cutoff_sq > 0)
+					sum.add(LJKernel<T, Shape>::energy_cutoff(span, row, x, y, z, cutoff_sq));
+				else
+					sum.add(LJKernel<T, Shape>::energy(span, row, x, y, z));
+				return;
+			}
+
+			T terms[TERM_CHUNK];
+			for (std::size_t begin=0; begin < span.size; begin += TERM_CHUNK) {
+				auto chunk = span.subspan(begin, std::min(begin + TERM_CHUNK, span.size));
+				if (terms_table)
+					LJKernel<T, Shape>::table_terms(chunk, *terms_table, x, y, z, cutoff_sq, terms);
+				else
+					LJKernel<T, Shape>::terms(chunk, row, x, y, z, cutoff_sq, terms);
+				sum.add(terms, chunk.size);
+			}
+		}
+
+		// Adds each term of the particles of a column span at height zs[k] to sums[k].
+		// (as add_energies; only for summation other than Naive)
+		void add_column_terms(const LJColumnSpan<T> & span, const std::vector<T> & zs, T cutoff_sq, const LJPairTable<T> * terms_table, std::vector<Accumulator<T>> & sums) const
+		{
+			T terms[TERM_CHUNK];
+			for (std::size_t begin=0; begin < span.size; begin += TERM_CHUNK) {
+				auto chunk = span.subspan(begin, std::min(begin + TERM_CHUNK, span.size));
+				for (std::size_t k=0; k < zs.size(); k++) {
+					if (terms_table)
+						LJKernel<T, Shape>::column_table_terms(chunk, *terms_table, zs[k], cutoff_sq, terms);
+					else
+						LJKernel<T, Shape>::column_terms(chunk, zs[k], cutoff_sq, terms);
+					sums[k].add(terms, chunk.size);
+				}
+			}
+		}
+
+		// Gathers every particle that may interact with the points (x, y, zs[k]) into
+		//  `buffer`, and calls sweep(span) on the gathered particles whenever about a tile's
+		//  worth has accumulated, so that the buffer stays resident in L1 across the sweep.
+		// (not for far-field mode)
+		template <class F>
+		void for_each_column_tile(T x, T y, const std::vector<T> & zs, LJColumnBuffer<T> & buffer, F && sweep) const
+		{
+			T cutoff_sq = has_cutoff()? cutoff_radius * cutoff_radius : T(0);
+			auto row = species.probe_row();
+
+			auto flush = [&] () {
+				sweep(buffer.span());
+				buffer.clear();
+			};
+
+			auto z_range = std::minmax_element(zs.begin(), zs.end());
+			buffer.clear();
+			for_each_column_interaction(x, y, *z_range.first, *z_range.second, [&] (const LJParticleSpan<T> & span, T sx, T sy, T z_offset) {
+				if (has_cutoff())
+					buffer.gather_within(span, row, sx, sy, z_offset, cutoff_sq);
+				else
+					buffer.gather(span, row, sx, sy, z_offset);
+				if (buffer.size() >= PARTICLE_TILE)
+					flush();
+			});
+			flush();
+		}
+
+		// The column counterpart of for_each_interaction: calls f(span, x', y', z_offset) for
+		//  every block of particles that may interact with a point (x, y, z) for z between z_a
+		//  and z_b, where the image of the block being considered is found by moving the
+		//  column to (x', y') and the particles up by z_offset.
+		template <class F>
+		void for_each_column_interaction(T x, T y, T z_a, T z_b, F && f) const
+		{
+			if (!has_cutoff()) {
+				auto all = this->particles.span();
+				for (std::size_t begin=0; begin < all.size; begin += PARTICLE_TILE) {
+					auto tile = all.subspan(begin, std::min(begin + PARTICLE_TILE, all.size));
+					for (auto & t : image_shifts)
+						f(tile, x - t[0], y - t[1], t[2]);
+				}
+				return;
+			}
+
+			T z_lo = std::min(z_a, z_b);
+			T z_hi = std::max(z_a, z_b);
+
+			// Images that can reach the cutoff sphere of either end of the column.
+			// Fractional coordinates vary linearly along the column, so this also covers
+			//  every point in between.
+			Vector frac_a = cell.fractional(Vector {{x, y, z_a}});
+			Vector frac_b = cell.fractional(Vector {{x, y, z_b}});
+			long first[3], last[3];
+			for (int a=0; a<3; a++) {
+				long first_b, last_b;
+				cell.image_range(a, frac_a[a], cutoff_radius, fractional_lo[a], fractional_hi[a], first[a], last[a]);
+				cell.image_range(a, frac_b[a], cutoff_radius, fractional_lo[a], fractional_hi[a], first_b, last_b);
+				first[a] = std::min(first[a], first_b);
+				last[a]  = std::max(last[a], last_b);
+			}
+
+			for (long n0=first[0]; n0 <= last[0]; n0++) {
+				for (long n1=first[1]; n1 <= last[1]; n1++) {
+					for (long n2=first[2]; n2 <= last[2]; n2++) {
+						Vector t = cell.translation(n0, n1, n2);
+						T sx = x - t[0], sy = y - t[1];
+
+						Vector lower = {{sx - cutoff_radius, sy - cutoff_radius, z_lo - t[2] - cutoff_radius}};
+						Vector upper = {{sx + cutoff_radius, sy + cutoff_radius, z_hi - t[2] + cutoff_radius}};
+						cells.for_each_span_in_box(lower, upper, [&] (const LJParticleSpan<T> & span) {
+							f(span, sx, sy, t[2]);
+						});
+					}
+				}
+			}
+		}
+
+		// Coordinates of the points along one axis of a lattice
+		// (a single point sits at the lower coordinate)
+		static std::vector<T> axis_coords(const Lattice3<T> & lattice, int axis)
+		{
+			std::vector<T> coords(lattice.size_n(axis));
+			for (std::size_t i=0; i < coords.size(); i++)
+				coords[i] = (coords.size() == 1)? lattice.lower_coord_n(axis) : lattice.coord_n(axis, i);
+			return coords;
+		}
+
+		void check_particle_index(std::size_t i) const
+		{
+			if (i >= size())
+				throw std::out_of_range("MiePotential: no such particle");
+		}
+
+		// Runs edit(), which patches the lattice for the particles themselves, and then
+		//  accounts for the resulting change to the tail correction.
+		template <class Edit>
+		void edit_with_lattice(Lattice3<T> & lattice, Edit && edit)
+		{
+			// (the lattice is assumed to match the current state)
+			require_finalized();
+			LJSlabTail<T, Shape> old_tail = tail;
+
+			edit();
+			finalize();
+
+			if (!applies_tail())
+				return;
+
+			std::vector<T> zs = axis_coords(lattice, 2);
+			for (std::size_t k=0; k < zs.size(); k++) {
+				T delta = tail.energy(zs[k], cutoff_radius) - old_tail.energy(zs[k], cutoff_radius);
+				for (std::size_t i=0; i < lattice.size_0(); i++)
+					for (std::size_t j=0; j < lattice.size_1(); j++)
+						lattice(i, j, k) += delta;
+			}
+		}
+
+		// Adds `sign` times the contribution of a single particle of species s at (px, py, pz)
+		//  to every point of the lattice, computing each term just as evaluate_on_lattice
+		//  does.  (the tail correction is not included)
+		void add_particle_to_lattice(Lattice3<T> & lattice, T px, T py, T pz, LJSpeciesIndex s, T sign) const
+		{
+			std::vector<T> xs = axis_coords(lattice, 0);
+			std::vector<T> ys = axis_coords(lattice, 1);
+			std::vector<T> zs = axis_coords(lattice, 2);
+			if (xs.empty() || ys.empty() || zs.empty())
+				return;
+
+			auto row = species.probe_row();
+			T energy_unit = row.energy_unit[s];
+			T length_unit_sq = row.length_unit_sq[s];
+			T cutoff_sq = has_cutoff()? cutoff_radius * cutoff_radius : std::numeric_limits<T>::infinity();
+
+			for (auto & t : lattice_image_shifts(xs, ys, zs, px, py, pz)) {
+				T z_image = pz + t[2];
+				for (std::size_t i=0; i < xs.size(); i++) {
+					T dx = (xs[i] - t[0]) - px;
+					if (!(dx*dx < cutoff_sq))
+						continue;
+
+					for (std::size_t j=0; j < ys.size(); j++) {
+						T dy = (ys[j] - t[1]) - py;
+						T lateral_sq = dx*dx + dy*dy;
+						if (!(lateral_sq < cutoff_sq))
+							continue;
+
+						for (std::size_t k=0; k < zs.size(); k++) {
+							T dz = zs[k] - z_image;
+							T r2 = lateral_sq + dz*dz;
+							if (r2 < cutoff_sq)
+								lattice(i, j, k) += sign * (has_tabulation()?
+									table.energy(s, r2) : Shape::term(energy_unit, length_unit_sq, r2));
+						}
+					}
+				}
+			}
+		}
+
+		// Translations of the periodic images of a particle at p that contribute to some
+		//  point of a lattice with the given axes
+		std::vector<Vector> lattice_image_shifts(
+			const std::vector<T> & xs, const std::vector<T> & ys, const std::vector<T> & zs,
+			T px, T py, T pz) const
+		{
+			if (!has_cutoff())
+				return image_shifts;
+
+			// fractional extent of the lattice's bounding box
+			Vector frac_lo, frac_hi;
+			for (int corner=0; corner < 8; corner++) {
+				Vector f = cell.fractional(Vector {{
+					(corner & 1)? xs.back() : xs.front(),
+					(corner & 2)? ys.back() : ys.front(),
+					(corner & 4)? zs.back() : zs.front(),
+				}});
+				for (int a=0; a<3; a++) {
+					if (corner == 0 || f[a] < frac_lo[a]) frac_lo[a] = f[a];
+					if (corner == 0 || f[a] > frac_hi[a]) frac_hi[a] = f[a];
+				}
+			}
+
+			Vector frac_p = cell.fractional(Vector {{px, py, pz}});
+			long first[3], last[3];
+			for (int a=0; a<3; a++) {
+				long first_hi, last_hi;
+				cell.image_range(a, frac_lo[a], cutoff_radius, frac_p[a], frac_p[a], first[a], last[a]);
+				cell.image_range(a, frac_hi[a], cutoff_radius, frac_p[a], frac_p[a], first_hi, last_hi);
+				first[a] = std::min(first[a], first_hi);
+				last[a]  = std::max(last[a], last_hi);
+			}
+
+			std::vector<Vector> shifts;
+			for (long n0=first[0]; n0 <= last[0]; n0++)
+				for (long n1=first[1]; n1 <= last[1]; n1++)
+					for (long n2=first[2]; n2 <= last[2]; n2++)
+						shifts.push_back(cell.translation(n0, n1, n2));
+			return shifts;
+		}
+
+		void require_finalized() const
+		{
+			if (stale && (has_cutoff() || has_far_field()))
+				throw std::logic_error("MiePotential: particles were added after the cell list or octree was built; call finalize()");
+		}
+
+		// Calls near(span, x', y', z') for every octree leaf that must be summed exactly at
+		//  (x,y,z), and far(cluster, x', y', z') for every cluster that may stand in for its
+		//  particles, for each image as in for_each_interaction without a cutoff.
+		template <class Near, class Far>
+		void for_each_far_field_interaction(T x, T y, T z, Near && near, Far && far) const
+		{
+			require_finalized();
+			for (auto & t : image_shifts) {
+				T sx = x - t[0], sy = y - t[1], sz = z - t[2];
+				tree.traverse(sx, sy, sz, theta,
+					[&] (const LJParticleSpan<T> & span) { near(span, sx, sy, sz); },
+					[&] (const LJCluster<T, Shape> & cluster)   { far(cluster, sx, sy, sz); }
+				);
+			}
+		}
+
+		// Image translations summed over in the absence of a cutoff
+		void compute_image_shifts()
+		{
+			long n[3];
+			for (int a=0; a<3; a++)
+				n[a] = cell.periodic(a)? long(image_count) : 0;
+
+			image_shifts.clear();
+			for (long n0=-n[0]; n0 <= n[0]; n0++)
+				for (long n1=-n[1]; n1 <= n[1]; n1++)
+					for (long n2=-n[2]; n2 <= n[2]; n2++)
+						image_shifts.push_back(cell.translation(n0, n1, n2));
+		}
+
+		void compute_fractional_bounds()
+		{
+			fractional_lo.fill(0);
+			fractional_hi.fill(0);
+			for (std::size_t i=0; i < particles.size(); i++) {
+				Vector f = cell.fractional(Vector {{particles.x()[i], particles.y()[i], particles.z()[i]}});
+				for (int a=0; a<3; a++) {
+					if (i == 0 || f[a] < fractional_lo[a]) fractional_lo[a] = f[a];
+					if (i == 0 || f[a] > fractional_hi[a]) fractional_hi[a] = f[a];
+				}
+			}
+		}
+
+		LJParticleArrays<T> particles;
+		LJSpeciesTable<T> species;
+		std::vector<std::size_t> origin;  // original_index() of each particle
+
+		T cutoff_radius = 0;  // 0 for no cutoff
+		bool tail_correction = true;
+		bool stale = false;   // true if particles were added since finalize()
+		SummationMethod summation = SummationMethod::Naive;
+
+		std::size_t table_intervals = 0;  // 0 when not tabulated
+		PairFunction pair_function;       // empty for the Mie potential itself
+		LJPairTable<T> table;
+
+		LJCellList<T> cells;
+		LJSlabTail<T, Shape> tail;
+
+		T theta = 0;          // opening angle for far-field mode, or 0
+		LJOctree<T, Shape> tree;
+
+		LJPeriodicCell<T> cell;
+		unsigned image_count = 1;
+		std::vector<Vector> image_shifts;    // always contains at least the zero vector
+		Vector fractional_lo {{0, 0, 0}};    // fractional bounding box of the particles
+		Vector fractional_hi {{0, 0, 0}};
 };
+
+// (std::min takes its arguments by reference, so these need definitions)
+template <class T, int N, int M> const std::size_t MiePotential<T, N, M>::PARTICLE_TILE;
+template <class T, int N, int M> const std::size_t MiePotential<T, N, M>::POINT_BLOCK;
+template <class T, int N, int M> const std::size_t MiePotential<T, N, M>::COLUMN_BLOCK;
+template <class T, int N, int M> const std::size_t MiePotential<T, N, M>::OCTREE_LEAF;
+template <class T, int N, int M> const std::size_t MiePotential<T, N, M>::MAX_TABLE_INTERVALS;
+template <class T, int N, int M> const std::size_t MiePotential<T, N, M>::TERM_CHUNK;
+
+template <class T>
+using LJPotential = MiePotential<T, 12, 6>;
+
+// Fills a lattice with the values of a potential; see MiePotential::evaluate_on_lattice.
+template <class T, int N, int M>
+void evaluate_on_lattice(const MiePotential<T, N, M> & potential, Lattice3<T> & lattice, unsigned threads=0)
+{
+	potential.evaluate_on_lattice(lattice, threads);
+}
+
+// Fills lattices[k] with the values felt by a probe of species probes[k]; see
+//  MiePotential::evaluate_on_lattices.
+template <class T, int N, int M>
+void evaluate_on_lattices(const MiePotential<T, N, M> & potential, const std::vector<LJSpeciesIndex> & probes, std::vector<Lattice3<T>> & lattices, unsigned threads=0)
+{
+	potential.evaluate_on_lattices(probes, lattices, threads);
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <limits>
+
+#include "particle-arrays.hpp"
+
+// A uniform grid of cells ("linked cells") over a set of LJ particles, used to find all of
+//  the particles within some radius of a point without visiting the rest.
+//
+// Rather than literally linking the particles of a cell together, the list keeps its own
+//  copy of the particles sorted by cell (z fastest), so that the cells in a column of the
+//  grid form one contiguous span that the SIMD kernels can stream through.  The copy costs
+//  as much memory as the particles themselves.
+//
+// Particles outside the grid's bounds are clamped into the boundary cells, and queries are
+//  clamped the same way, so lookups remain correct no matter where the points lie.
+template <class T>
+class LJCellList {
+	public:
+		typedef std::array<T, 3> Point;
+
+		// Sorts the particles into cells of (at least) the given size.
+		// The cell size is increased as necessary so that the number of cells never exceeds
+		//  max(1, cells_per_particle * particles.size()), which keeps a sparse sample (or a
+		//  silly cell size) from allocating absurd amounts of memory.
+		void build (const LJParticleArrays<T> & particles, T cell_size, std::size_t cells_per_particle=2)
+		{
+			std::size_t n = particles.size();
+
+			compute_bounds(particles);
+
+			std::size_t max_cells = std::max<std::size_t>(1, cells_per_particle * n);
+			T size = cell_size;
+			while (!choose_dims(size, max_cells))
+				size *= 2;
+
+			// counting sort by cell index
+			std::vector<std::size_t> cell_of(n);
+			_cell_start.assign(num_cells() + 1, 0);
+			for (std::size_t i=0; i < n; i++) {
+				cell_of[i] = cell_index(particles.x()[i], particles.y()[i], particles.z()[i]);
+				_cell_start[cell_of[i] + 1]++;
+			}
+
+			for (std::size_t c=0; c < num_cells(); c++)
+				_cell_start[c+1] += _cell_start[c];
+
+			std::vector<std::size_t> slot(_cell_start.begin(), _cell_start.end() - 1);
+			_original_index.assign(n, 0);
+			for (std::size_t i=0; i < n; i++)
+				_original_index[slot[cell_of[i]]++] = i;
+
+			_particles.clear();
+			_particles.reserve(n);
+			for (std::size_t k=0; k < n; k++)
+				_particles.push_back_from(particles, _original_index[k]);
+		}
+
+		// Calls f(span) for a set of disjoint spans which, together, contain every particle
+		//  within `radius` of (x,y,z) (and generally a number of others, which the caller must
+		//  filter out by distance).
+		template <class F>
+		void for_each_span_near (T x, T y, T z, T radius, F && f) const
+		{
+			Point lower = {{x - radius, y - radius, z - radius}};
+			Point upper = {{x + radius, y + radius, z + radius}};
+			for_each_span_in_box(lower, upper, f);
+		}
+
+		// Likewise, for every particle inside the axis-aligned box [lower, upper].
+		template <class F>
+		void for_each_span_in_box (const Point & lower, const Point & upper, F && f) const
+		{
+			if (_particles.size() == 0)
+				return;
+
+			std::size_t lo[3], hi[3];
+			for (int a=0; a<3; a++) {
+				lo[a] = axis_cell(a, lower[a]);
+				hi[a] = axis_cell(a, upper[a]);
+			}
+
+			auto all = _particles.span();
+			for (std::size_t i=lo[0]; i <= hi[0]; i++) {
+				for (std::size_t j=lo[1]; j <= hi[1]; j++) {
+					// cells lo[2]..hi[2] of this column are adjacent in memory
+					std::size_t column = (i * _dims[1] + j) * _dims[2];
+					std::size_t begin = _cell_start[column + lo[2]];
+					std::size_t end   = _cell_start[column + hi[2] + 1];
+					if (begin != end)
+						f(all.subspan(begin, end));
+				}
+			}
+		}
+
+		std::size_t size () const { return _particles.size(); }
+		std::size_t num_cells () const { return _dims[0] * _dims[1] * _dims[2]; }
+		std::array<std::size_t, 3> dims () const { return _dims; }
+
+		// Bounding box of the particles
+		Point lower_bounds () const { return _lower; }
+		Point upper_bounds () const { return _upper; }
+
+		// The particles in cell order, and the index each one had in the source arrays
+		const LJParticleArrays<T> & particles () const { return _particles; }
+		const std::vector<std::size_t> & original_index () const { return _original_index; }
+
+	private:
+		Point _lower {{0, 0, 0}};
+		Point _upper {{0, 0, 0}};
+		Point _inv_cell_size {{1, 1, 1}};
+		std::array<std::size_t, 3> _dims {{1, 1, 1}};
+
+		std::vector<std::size_t> _cell_start; // particles of cell c are [_cell_start[c], _cell_start[c+1])
+		std::vector<std::size_t> _original_index;
+		LJParticleArrays<T> _particles;
+
+		void compute_bounds (const LJParticleArrays<T> & particles) {
+			const typename LJParticleArrays<T>::array_type * coords[3] = {
+				&particles.x(), &particles.y(), &particles.z(),
+			};
+
+			for (int a=0; a<3; a++) {
+				if (particles.size() == 0) {
+					_lower[a] = _upper[a] = 0;
+				} else {
+					auto minmax = std::minmax_element(coords[a]->begin(), coords[a]->end());
+					_lower[a] = *minmax.first;
+					_upper[a] = *minmax.second;
+				}
+			}
+		}
+
+		// Returns false if the cell size leads to too many cells
+		bool choose_dims (T cell_size, std::size_t max_cells) {
+			double total = 1;
+			for (int a=0; a<3; a++) {
+				T extent = _upper[a] - _lower[a];
+				double count = std::max(1., std::ceil(double(extent / cell_size)));
+				total *= count;
+				if (total > double(max_cells))
+					return false;
+
+				_dims[a] = std::size_t(count);
+				_inv_cell_size[a] = T(1) / cell_size;
+			}
+			return true;
+		}
+
+		// Clamped cell coordinate along one axis
+		std::size_t axis_cell (int axis, T value) const {
+			T scaled = (value - _lower[axis]) * _inv_cell_size[axis];
+			if (!(scaled > 0)) // (also catches NaN)
+				return 0;
+			if (scaled >= T(_dims[axis]))
+				return _dims[axis] - 1;
+			return std::size_t(scaled);
+		}
+
+		std::size_t cell_index (T x, T y, T z) const {
+			return (axis_cell(0, x) * _dims[1] + axis_cell(1, y)) * _dims[2] + axis_cell(2, z);
+		}
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+
+#include "particle-arrays.hpp"
+
+// Particles prepared for evaluation along a vertical line of points (x, y, z_0..z_n).
+//
+// Along such a line, the lateral part of each squared distance is fixed, so it is computed
+//  once when the particle is gathered and each point of the line then only costs
+//  r^2 = lateral_sq + (z - z_p)^2.
+template <class T>
+struct LJColumnSpan {
+	const T * lateral_sq;     // (x - x_p)^2 + (y - y_p)^2
+	const T * z;
+	const T * energy_unit;
+	const T * length_unit_sq;
+	const LJSpeciesIndex * species;  // (for the tabulated kernels)
+	std::size_t size;
+
+	LJColumnSpan subspan (std::size_t begin, std::size_t end) const {
+		return LJColumnSpan {
+			lateral_sq + begin, z + begin,
+			energy_unit + begin, length_unit_sq + begin,
+			species + begin,
+			end - begin,
+		};
+	}
+};
+
+// Reusable storage for an LJColumnSpan.
+// The arrays only ever grow, so that once warmed up, gathering performs no allocation.
+template <class T>
+class LJColumnBuffer {
+	public:
+		typedef typename LJParticleArrays<T>::array_type array_type;
+
+		void clear () { _size = 0; }
+
+		// Appends every particle of `span` for the line through (x, y), with their heights
+		//  offset by z_offset (which lets a periodic image of the particles be gathered
+		//  without copying it first), looking up their parameters in `row`.
+		void gather (const LJParticleSpan<T> & span, const LJPairRow<T> & row, T x, T y, T z_offset) {
+			ensure_capacity(_size + span.size);
+
+			T * lateral_sq     = _lateral_sq.data() + _size;
+			T * z              = _z.data() + _size;
+			T * energy_unit    = _energy_unit.data() + _size;
+			T * length_unit_sq = _length_unit_sq.data() + _size;
+			LJSpeciesIndex * species = _species.data() + _size;
+			for (std::size_t i=0; i < span.size; i++) {
+				T dx = x - span.x[i];
+				T dy = y - span.y[i];
+				lateral_sq[i]     = dx*dx + dy*dy;
+				z[i]              = span.z[i] + z_offset;
+				energy_unit[i]    = row.energy_unit[span.species[i]];
+				length_unit_sq[i] = row.length_unit_sq[span.species[i]];
+				species[i]        = span.species[i];
+			}
+			_size += span.size;
+		}
+
+		// Likewise, but only for the particles strictly within sqrt(max_lateral_sq) of the line.
+		void gather_within (const LJParticleSpan<T> & span, const LJPairRow<T> & row, T x, T y, T z_offset, T max_lateral_sq) {
+			ensure_capacity(_size + span.size);
+
+			for (std::size_t i=0; i < span.size; i++) {
+				T dx = x - span.x[i];
+				T dy = y - span.y[i];
+				T lateral_sq = dx*dx + dy*dy;
+				if (!(lateral_sq < max_lateral_sq))
+					continue;
+
+				_lateral_sq[_size]     = lateral_sq;
+				_z[_size]              = span.z[i] + z_offset;
+				_energy_unit[_size]    = row.energy_unit[span.species[i]];
+				_length_unit_sq[_size] = row.length_unit_sq[span.species[i]];
+				_species[_size]        = span.species[i];
+				_size++;
+			}
+		}
+
+		// Replaces the parameters of the gathered particles with those from another row,
+		//  as for a different probe
+		void restage (const LJPairRow<T> & row) {
+			for (std::size_t i=0; i < _size; i++) {
+				_energy_unit[i]    = row.energy_unit[_species[i]];
+				_length_unit_sq[i] = row.length_unit_sq[_species[i]];
+			}
+		}
+
+		std::size_t size () const { return _size; }
+
+		LJColumnSpan<T> span () const {
+			return LJColumnSpan<T> {
+				_lateral_sq.data(), _z.data(),
+				_energy_unit.data(), _length_unit_sq.data(),
+				_species.data(),
+				size(),
+			};
+		}
+
+	private:
+		array_type _lateral_sq;
+		array_type _z;
+		array_type _energy_unit;
+		array_type _length_unit_sq;
+		typename LJParticleArrays<T>::species_array_type _species;
+		std::size_t _size = 0; // elements in use (the arrays may be longer)
+
+		void ensure_capacity (std::size_t n) {
+			if (n <= _z.size())
+				return;
+			n = std::max(n, 2 * _z.size());
+			_lateral_sq.resize(n);
+			_z.resize(n);
+			_energy_unit.resize(n);
+			_length_unit_sq.resize(n);
+			_species.resize(n);
+		}
+};
@@ -0,0 +1,462 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#include "particle-arrays.hpp"
+#include "column-buffer.hpp"
+#include "mie-shape.hpp"
+#include "pair-table.hpp"
+#include "../util/simd.hpp"
+
+// Summation kernels for MiePotential (and so LJPotential).
+//
+// Each kernel is written once over a vector type V (see util/simd.hpp) and a MieShape,
+//  and instantiated for the widest type the build supports.  (the exponents are template
+//  parameters, so each shape gets kernels of its own, with the powers unrolled into
+//  multiplies)  Wide instruction sets are only used when enabled at build time (e.g.
+//  -mavx2, -mavx512f, or -march=native); otherwise LJKernel falls back to the scalar
+//  instantiation.  Only T=double has explicit SIMD types.
+//
+// ACCURACY:  Every kernel evaluates each individual term with the same sequence of IEEE
+//  operations as Shape::term() (see mie-shape.hpp), so the terms themselves match the
+//  scalar loop bitwise -- unless the compiler is allowed to contract mul+add into FMA
+//  (-ffp-contract=fast, GCC's default outside of strict ISO modes), which perturbs each
+//  term by a few ulp.  The main difference is the *order* in which terms are summed: a
+//  kernel of width W keeps W partial sums, which are combined at the end before the
+//  scalar remainder is added.  Consequently, for n particles,
+//
+//     |simd - scalar| <= (n/W + W + 4) ulp(sum of |term|)
+//
+//  which is the tolerance the unit tests check against.  When all of the terms share a sign
+//  (e.g. anywhere beyond the minimum), this is a bound on the relative error as well.
+
+// Squared distance from (x,y,z) to the particles at [i, i+V::width)
+template <class V>
+inline V lj_delta_r2 (const LJParticleSpan<typename V::scalar> & p, std::size_t i, V x, V y, V z)
+{
+	V delta_x = x - V::load(p.x + i);
+	V delta_y = y - V::load(p.y + i);
+	V delta_z = z - V::load(p.z + i);
+	return delta_x*delta_x + delta_y*delta_y + delta_z*delta_z;
+}
+
+// Sum of all terms.
+template <class V, class Shape, class T>
+T lj_energy_vec (const LJParticleSpan<T> & p, const LJPairRow<T> & row, T x, T y, T z)
+{
+	V vx(x), vy(y), vz(z);
+	V acc = V::zero();
+
+	std::size_t i = 0;
+	for (; i + V::width <= p.size; i += V::width) {
+		V r2 = lj_delta_r2(p, i, vx, vy, vz);
+		acc = acc + Shape::term(V::gather(row.energy_unit, p.species + i), V::gather(row.length_unit_sq, p.species + i), r2);
+	}
+
+	T result = acc.sum();
+	if (i < p.size)
+		result += lj_energy_vec<SimdScalar<T>, Shape>(p.subspan(i, p.size), row, x, y, z);
+	return result;
+}
+
+// Sum of the terms for particles strictly closer than sqrt(cutoff_sq).
+template <class V, class Shape, class T>
+T lj_energy_cutoff_vec (const LJParticleSpan<T> & p, const LJPairRow<T> & row, T x, T y, T z, T cutoff_sq)
+{
+	V vx(x), vy(y), vz(z), vcut(cutoff_sq);
+	V acc = V::zero();
+
+	std::size_t i = 0;
+	for (; i + V::width <= p.size; i += V::width) {
+		V r2 = lj_delta_r2(p, i, vx, vy, vz);
+		V term = Shape::term(V::gather(row.energy_unit, p.species + i), V::gather(row.length_unit_sq, p.species + i), r2);
+		acc = acc + select_less(r2, vcut, term);
+	}
+
+	T result = acc.sum();
+	if (i < p.size)
+		result += lj_energy_cutoff_vec<SimdScalar<T>, Shape>(p.subspan(i, p.size), row, x, y, z, cutoff_sq);
+	return result;
+}
+
+// Sum of the terms at height z on the line described by a column span.
+// With Cutoff, only particles strictly closer than sqrt(cutoff_sq) contribute.
+template <class V, class Shape, bool Cutoff, class T>
+T lj_column_energy_vec (const LJColumnSpan<T> & p, T z, T cutoff_sq)
+{
+	V vz(z), vcut(cutoff_sq);
+	V acc = V::zero();
+
+	std::size_t i = 0;
+	for (; i + V::width <= p.size; i += V::width) {
+		V dz = vz - V::load(p.z + i);
+		V r2 = V::load(p.lateral_sq + i) + dz*dz;
+		V term = Shape::term(V::load(p.energy_unit + i), V::load(p.length_unit_sq + i), r2);
+		acc = acc + (Cutoff? select_less(r2, vcut, term) : term);
+	}
+
+	T result = acc.sum();
+	if (i < p.size)
+		result += lj_column_energy_vec<SimdScalar<T>, Shape, Cutoff>(p.subspan(i, p.size), z, cutoff_sq);
+	return result;
+}
+
+// Spline lookups in an LJPairTable, with the table's constants broadcast once up front.
+template <class V>
+struct LJTableLookup {
+	typedef typename V::scalar T;
+
+	V u_min, inv_step, last;
+	const T * coeffs;
+	const T * base;
+
+	explicit LJTableLookup (const LJPairTable<T> & table)
+	: u_min(table.u_min()), inv_step(table.inv_step()), last(T(table.intervals()))
+	, coeffs(table.coeffs()), base(table.base())
+	{ }
+
+	// Energies of the particles of the given species at squared distances u
+	V operator() (const LJSpeciesIndex * species, V u) const {
+		V x = min(max((u - u_min) * inv_step, V::zero()), last);
+		V k = trunc(x);
+		V t = x - k;
+		V index = (V::gather(base, species) + k) * V(T(4));
+		V c0 = V::gather_at(coeffs, index);
+		V c1 = V::gather_at(coeffs + 1, index);
+		V c2 = V::gather_at(coeffs + 2, index);
+		V c3 = V::gather_at(coeffs + 3, index);
+		return c0 + t * (c1 + t * (c2 + t * c3));
+	}
+};
+
+// lj_energy_cutoff_vec, with the terms looked up in a table.
+template <class V, class T>
+T lj_energy_table_vec (const LJParticleSpan<T> & p, const LJPairTable<T> & table, T x, T y, T z, T cutoff_sq)
+{
+	LJTableLookup<V> lookup(table);
+	V vx(x), vy(y), vz(z), vcut(cutoff_sq);
+	V acc = V::zero();
+
+	std::size_t i = 0;
+	for (; i + V::width <= p.size; i += V::width) {
+		V r2 = lj_delta_r2(p, i, vx, vy, vz);
+		acc = acc + select_less(r2, vcut, lookup(p.species + i, r2));
+	}
+
+	T result = acc.sum();
+	if (i < p.size)
+		result += lj_energy_table_vec<SimdScalar<T>>(p.subspan(i, p.size), table, x, y, z, cutoff_sq);
+	return result;
+}
+
+// lj_column_energy_vec with a cutoff, with the terms looked up in a table.
+template <class V, class T>
+T lj_column_energy_table_vec (const LJColumnSpan<T> & p, const LJPairTable<T> & table, T z, T cutoff_sq)
+{
+	LJTableLookup<V> lookup(table);
+	V vz(z), vcut(cutoff_sq);
+	V acc = V::zero();
+
+	std::size_t i = 0;
+	for (; i + V::width <= p.size; i += V::width) {
+		V dz = vz - V::load(p.z + i);
+		V r2 = V::load(p.lateral_sq + i) + dz*dz;
+		acc = acc + select_less(r2, vcut, lookup(p.species + i, r2));
+	}
+
+	T result = acc.sum();
+	if (i < p.size)
+		result += lj_column_energy_table_vec<SimdScalar<T>>(p.subspan(i, p.size), table, z, cutoff_sq);
+	return result;
+}
+
+// The individual terms summed by lj_energy_cutoff_vec (with Cutoff; zero beyond the
+//  cutoff) or lj_energy_vec (without), written to out[0..p.size).
+// Each term is the same whatever the width of V, so summing them in order on the scalar
+//  side gives a result that does not depend on the instruction set.
+template <class V, class Shape, bool Cutoff, class T>
+void lj_terms_vec (const LJParticleSpan<T> & p, const LJPairRow<T> & row, T x, T y, T z, T cutoff_sq, T * out)
+{
+	V vx(x), vy(y), vz(z), vcut(cutoff_sq);
+
+	std::size_t i = 0;
+	for (; i + V::width <= p.size; i += V::width) {
+		V r2 = lj_delta_r2(p, i, vx, vy, vz);
+		V term = Shape::term(V::gather(row.energy_unit, p.species + i), V::gather(row.length_unit_sq, p.species + i), r2);
+		(Cutoff? select_less(r2, vcut, term) : term).store(out + i);
+	}
+
+	if (i < p.size)
+		lj_terms_vec<SimdScalar<T>, Shape, Cutoff>(p.subspan(i, p.size), row, x, y, z, cutoff_sq, out + i);
+}
+
+// Likewise for lj_column_energy_vec
+template <class V, class Shape, bool Cutoff, class T>
+void lj_column_terms_vec (const LJColumnSpan<T> & p, T z, T cutoff_sq, T * out)
+{
+	V vz(z), vcut(cutoff_sq);
+
+	std::size_t i = 0;
+	for (; i + V::width <= p.size; i += V::width) {
+		V dz = vz - V::load(p.z + i);
+		V r2 = V::load(p.lateral_sq + i) + dz*dz;
+		V term = Shape::term(V::load(p.energy_unit + i), V::load(p.length_unit_sq + i), r2);
+		(Cutoff? select_less(r2, vcut, term) : term).store(out + i);
+	}
+
+	if (i < p.size)
+		lj_column_terms_vec<SimdScalar<T>, Shape, Cutoff>(p.subspan(i, p.size), z, cutoff_sq, out + i);
+}
+
+// Likewise for lj_energy_table_vec and lj_column_energy_table_vec
+template <class V, class T>
+void lj_table_terms_vec (const LJParticleSpan<T> & p, const LJPairTable<T> & table, T x, T y, T z, T cutoff_sq, T * out)
+{
+	LJTableLookup<V> lookup(table);
+	V vx(x), vy(y), vz(z), vcut(cutoff_sq);
+
+	std::size_t i = 0;
+	for (; i + V::width <= p.size; i += V::width) {
+		V r2 = lj_delta_r2(p, i, vx, vy, vz);
+		select_less(r2, vcut, lookup(p.species + i, r2)).store(out + i);
+	}
+
+	if (i < p.size)
+		lj_table_terms_vec<SimdScalar<T>>(p.subspan(i, p.size), table, x, y, z, cutoff_sq, out + i);
+}
+
+template <class V, class T>
+void lj_column_table_terms_vec (const LJColumnSpan<T> & p, const LJPairTable<T> & table, T z, T cutoff_sq, T * out)
+{
+	LJTableLookup<V> lookup(table);
+	V vz(z), vcut(cutoff_sq);
+
+	std::size_t i = 0;
+	for (; i + V::width <= p.size; i += V::width) {
+		V dz = vz - V::load(p.z + i);
+		V r2 = V::load(p.lateral_sq + i) + dz*dz;
+		select_less(r2, vcut, lookup(p.species + i, r2)).store(out + i);
+	}
+
+	if (i < p.size)
+		lj_column_table_terms_vec<SimdScalar<T>>(p.subspan(i, p.size), table, z, cutoff_sq, out + i);
+}
+
+// Energy together with its first and (optionally) second derivatives at a point.
+template <class T>
+struct LJEvaluation {
+	T energy;
+	std::array<T, 3> force;                  // minus the gradient
+	std::array<std::array<T, 3>, 3> hessian; // second derivatives of the energy (zero unless requested)
+
+	static LJEvaluation zero () {
+		LJEvaluation e;
+		e.energy = 0;
+		e.force = {{0, 0, 0}};
+		for (auto & row : e.hessian)
+			row = {{0, 0, 0}};
+		return e;
+	}
+};
+
+// Accumulates energy, force and (if Hessian) the Hessian into `out`, in one pass.
+//
+// Each term is a function of u = r^2 alone (see mie-shape.hpp for E'(u) and E''(u)), so
+//  with d = point - particle,
+//
+//     grad E    = 2 E'(u) d
+//     hess E_ij = 2 E'(u) delta_ij + 4 E''(u) d_i d_j
+//
+//  and everything is built from the single reciprocal 1/u.  (as a result, the energy may
+//  differ from the energy kernels in the last couple of bits)
+// With Cutoff, only particles strictly closer than sqrt(cutoff_sq) contribute.
+template <class V, class Shape, bool Cutoff, bool Hessian, class T>
+void lj_evaluate_vec (const LJParticleSpan<T> & p, const LJPairRow<T> & row, T x, T y, T z, T cutoff_sq, LJEvaluation<T> & out)
+{
+	V vx(x), vy(y), vz(z), vcut(cutoff_sq);
+	V energy = V::zero();
+	V gx = V::zero(), gy = V::zero(), gz = V::zero();
+	V hxx = V::zero(), hyy = V::zero(), hzz = V::zero();
+	V hxy = V::zero(), hxz = V::zero(), hyz = V::zero();
+
+	std::size_t i = 0;
+	for (; i + V::width <= p.size; i += V::width) {
+		V dx = vx - V::load(p.x + i);
+		V dy = vy - V::load(p.y + i);
+		V dz = vz - V::load(p.z + i);
+
+		V u = dx*dx + dy*dy + dz*dz;
+		V inv_u = V(T(1)) / u;
+		V s  = V::gather(row.length_unit_sq, p.species + i) * inv_u;
+		V eps = V::gather(row.energy_unit, p.species + i);
+
+		V a_att, a_rest;
+		Shape::powers(s, a_att, a_rest);
+
+		V e  = eps * (Shape::times_c_rep(a_rest) - V(T(Shape::c_att))) * a_att;
+		V d1 = V(T(-Shape::k)) * eps * (a_rest - V(T(1))) * a_att * inv_u;  // E'(u)
+		if (Cutoff) {
+			e  = select_less(u, vcut, e);
+			d1 = select_less(u, vcut, d1);
+		}
+
+		V two_d1 = d1 + d1;
+		energy = energy + e;
+		gx = gx + two_d1 * dx;
+		gy = gy + two_d1 * dy;
+		gz = gz + two_d1 * dz;
+
+		if (Hessian) {
+			V d2 = V(T(Shape::k)) * eps * (V(T(Shape::k_rep)) * a_rest - V(T(Shape::k_att))) * a_att * inv_u * inv_u;  // E''(u)
+			if (Cutoff)
+				d2 = select_less(u, vcut, d2);
+
+			V four_d2 = V(T(4)) * d2;
+			hxx = hxx + two_d1 + four_d2 * dx * dx;
+			hyy = hyy + two_d1 + four_d2 * dy * dy;
+			hzz = hzz + two_d1 + four_d2 * dz * dz;
+			hxy = hxy + four_d2 * dx * dy;
+			hxz = hxz + four_d2 * dx * dz;
+			hyz = hyz + four_d2 * dy * dz;
+		}
+	}
+
+	out.energy   += energy.sum();
+	out.force[0] -= gx.sum();
+	out.force[1] -= gy.sum();
+	out.force[2] -= gz.sum();
+	if (Hessian) {
+		T xx = hxx.sum(), yy = hyy.sum(), zz = hzz.sum();
+		T xy = hxy.sum(), xz = hxz.sum(), yz = hyz.sum();
+		out.hessian[0][0] += xx;  out.hessian[0][1] += xy;  out.hessian[0][2] += xz;
+		out.hessian[1][0] += xy;  out.hessian[1][1] += yy;  out.hessian[1][2] += yz;
+		out.hessian[2][0] += xz;  out.hessian[2][1] += yz;  out.hessian[2][2] += zz;
+	}
+
+	if (i < p.size)
+		lj_evaluate_vec<SimdScalar<T>, Shape, Cutoff, Hessian>(p.subspan(i, p.size), row, x, y, z, cutoff_sq, out);
+}
+
+// Adds the energy and vertical force at height z on the line described by a column span
+//  to `energy` and `force_z`, computed as in lj_evaluate_vec.
+// With Cutoff, only particles strictly closer than sqrt(cutoff_sq) contribute.
+template <class V, class Shape, bool Cutoff, class T>
+void lj_column_evaluate_vec (const LJColumnSpan<T> & p, T z, T cutoff_sq, T & energy, T & force_z)
+{
+	V vz(z), vcut(cutoff_sq);
+	V e_acc = V::zero();
+	V gz = V::zero();
+
+	std::size_t i = 0;
+	for (; i + V::width <= p.size; i += V::width) {
+		V dz = vz - V::load(p.z + i);
+		V u = V::load(p.lateral_sq + i) + dz*dz;
+		V inv_u = V(T(1)) / u;
+		V s = V::load(p.length_unit_sq + i) * inv_u;
+		V eps = V::load(p.energy_unit + i);
+
+		V a_att, a_rest;
+		Shape::powers(s, a_att, a_rest);
+
+		V e  = eps * (Shape::times_c_rep(a_rest) - V(T(Shape::c_att))) * a_att;
+		V d1 = V(T(-Shape::k)) * eps * (a_rest - V(T(1))) * a_att * inv_u;  // E'(u)
+		if (Cutoff) {
+			e  = select_less(u, vcut, e);
+			d1 = select_less(u, vcut, d1);
+		}
+
+		e_acc = e_acc + e;
+		gz = gz + (d1 + d1) * dz;
+	}
+
+	energy  += e_acc.sum();
+	force_z -= gz.sum();
+
+	if (i < p.size)
+		lj_column_evaluate_vec<SimdScalar<T>, Shape, Cutoff>(p.subspan(i, p.size), z, cutoff_sq, energy, force_z);
+}
+
+// The reference implementation: a plain serial loop.
+template <class Shape = LJShape, class T>
+T lj_energy_scalar (const LJParticleSpan<T> & p, const LJPairRow<T> & row, T x, T y, T z)
+{
+	return lj_energy_vec<SimdScalar<T>, Shape>(p, row, x, y, z);
+}
+
+// Dispatches to the best kernel available for T in this build.
+template <class T, class Shape = LJShape>
+struct LJKernel {
+	typedef typename SimdBest<T>::type vector_type;
+
+	static constexpr std::size_t simd_width () { return vector_type::width; }
+
+	static T energy (const LJParticleSpan<T> & p, const LJPairRow<T> & row, T x, T y, T z) {
+		return lj_energy_vec<vector_type, Shape>(p, row, x, y, z);
+	}
+
+	static T energy_cutoff (const LJParticleSpan<T> & p, const LJPairRow<T> & row, T x, T y, T z, T cutoff_sq) {
+		return lj_energy_cutoff_vec<vector_type, Shape>(p, row, x, y, z, cutoff_sq);
+	}
+
+	// Energy at height z along a column (see column-buffer.hpp).  A cutoff_sq of 0 means no cutoff.
+	static T column_energy (const LJColumnSpan<T> & p, T z, T cutoff_sq) {
+		if (cutoff_sq > 0)
+			return lj_column_energy_vec<vector_type, Shape, true>(p, z, cutoff_sq);
+		return lj_column_energy_vec<vector_type, Shape, false>(p, z, cutoff_sq);
+	}
+
+	// Adds the energy and vertical force at height z along a column to `energy` and `force_z`.
+	// A cutoff_sq of 0 means no cutoff.
+	static void column_evaluate (const LJColumnSpan<T> & p, T z, T cutoff_sq, T & energy, T & force_z) {
+		if (cutoff_sq > 0)
+			lj_column_evaluate_vec<vector_type, Shape, true>(p, z, cutoff_sq, energy, force_z);
+		else
+			lj_column_evaluate_vec<vector_type, Shape, false>(p, z, cutoff_sq, energy, force_z);
+	}
+
+	// Energies with a cutoff, looked up in a table (see pair-table.hpp)
+	static T energy_table (const LJParticleSpan<T> & p, const LJPairTable<T> & table, T x, T y, T z, T cutoff_sq) {
+		return lj_energy_table_vec<vector_type>(p, table, x, y, z, cutoff_sq);
+	}
+
+	static T column_energy_table (const LJColumnSpan<T> & p, const LJPairTable<T> & table, T z, T cutoff_sq) {
+		return lj_column_energy_table_vec<vector_type>(p, table, z, cutoff_sq);
+	}
+
+	// The individual terms of energy() or energy_cutoff(), written to out[0..p.size), for
+	//  summing in some other way.  A cutoff_sq of 0 means no cutoff.
+	static void terms (const LJParticleSpan<T> & p, const LJPairRow<T> & row, T x, T y, T z, T cutoff_sq, T * out) {
+		if (cutoff_sq > 0)
+			lj_terms_vec<vector_type, Shape, true>(p, row, x, y, z, cutoff_sq, out);
+		else
+			lj_terms_vec<vector_type, Shape, false>(p, row, x, y, z, cutoff_sq, out);
+	}
+
+	static void column_terms (const LJColumnSpan<T> & p, T z, T cutoff_sq, T * out) {
+		if (cutoff_sq > 0)
+			lj_column_terms_vec<vector_type, Shape, true>(p, z, cutoff_sq, out);
+		else
+			lj_column_terms_vec<vector_type, Shape, false>(p, z, cutoff_sq, out);
+	}
+
+	static void table_terms (const LJParticleSpan<T> & p, const LJPairTable<T> & table, T x, T y, T z, T cutoff_sq, T * out) {
+		lj_table_terms_vec<vector_type>(p, table, x, y, z, cutoff_sq, out);
+	}
+
+	static void column_table_terms (const LJColumnSpan<T> & p, const LJPairTable<T> & table, T z, T cutoff_sq, T * out) {
+		lj_column_table_terms_vec<vector_type>(p, table, z, cutoff_sq, out);
+	}
+
+	// Adds the energy, force and optionally Hessian of the particles in `p` to `out`.
+	// A cutoff_sq of 0 means no cutoff.
+	static void evaluate (const LJParticleSpan<T> & p, const LJPairRow<T> & row, T x, T y, T z, T cutoff_sq, bool hessian, LJEvaluation<T> & out) {
+		if (cutoff_sq > 0) {
+			if (hessian) lj_evaluate_vec<vector_type, Shape, true,  true >(p, row, x, y, z, cutoff_sq, out);
+			else         lj_evaluate_vec<vector_type, Shape, true,  false>(p, row, x, y, z, cutoff_sq, out);
+		} else {
+			if (hessian) lj_evaluate_vec<vector_type, Shape, false, true >(p, row, x, y, z, cutoff_sq, out);
+			else         lj_evaluate_vec<vector_type, Shape, false, false>(p, row, x, y, z, cutoff_sq, out);
+		}
+	}
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cmath>
+
+#include "../util/ipow.hpp"
+
+// The functional form of a Mie (N-M) potential, with both exponents fixed at compile time.
+//
+// In terms of the well depth eps and the position r_m of the minimum, each term is
+//
+//     E = eps / (N-M) * (M a^N - N a^M),     a = r_m / r
+//       = eps * (c_rep a^(N-M) - c_att) * a^M
+//
+//  which for N=12, M=6 is the familiar LJ form eps * (a^6 - 2) * a^6.
+//
+// The kernels work with s = a^2 = r_m^2 / r^2, so when both exponents are even every power
+//  is a short chain of multiplies (see util/ipow.hpp); odd exponents cost one square root.
+// Each function here is written over a scalar or SIMD type V, like the kernels.
+template <int N, int M>
+struct MieShape {
+	static_assert(N > M && M > 0, "Mie exponents must satisfy N > M > 0");
+
+	static const int repulsion_exponent = N;
+	static const int attraction_exponent = M;
+
+	static constexpr bool even = (N % 2 == 0) && (M % 2 == 0);
+
+	static constexpr double c_rep = double(M) / (N - M);
+	static constexpr double c_att = double(N) / (N - M);
+
+	// As a function of u = r^2,
+	//     E'(u)  = -k eps (a^(N-M) - 1) a^M / u
+	//     E''(u) =  k eps ((N/2 + 1) a^(N-M) - (M/2 + 1)) a^M / u^2
+	static constexpr double k = double(N) * M / (2 * (N - M));
+	static constexpr double k_rep = N / 2.0 + 1;
+	static constexpr double k_att = M / 2.0 + 1;
+
+	// a = sqrt(s), or just s itself when it will not be needed
+	template <class V>
+	static V root (V s) {
+		using std::sqrt;
+		return even? s : sqrt(s);
+	}
+
+	// a^M and a^(N-M), given s = a^2
+	template <class V>
+	static void powers (V s, V & a_att, V & a_rest) {
+		V a = root(s);
+		a_att  = half_ipow<M>(s, a);
+		a_rest = (N - M == M)? a_att : half_ipow<N - M>(s, a);
+	}
+
+	// c_rep * x, skipping the multiply when it is 1 (as for LJ)
+	template <class V>
+	static V times_c_rep (V x) {
+		return (c_rep == 1)? x : V(c_rep) * x;
+	}
+
+	// Energy of a single term at squared distance u
+	template <class V>
+	static V term (V energy_unit, V length_unit_sq, V u) {
+		V a_att, a_rest;
+		powers(length_unit_sq / u, a_att, a_rest);
+		return energy_unit * (times_c_rep(a_rest) - V(c_att)) * a_att;
+	}
+};
+
+template <int N, int M> const int MieShape<N, M>::repulsion_exponent;
+template <int N, int M> const int MieShape<N, M>::attraction_exponent;
+template <int N, int M> constexpr bool MieShape<N, M>::even;
+template <int N, int M> constexpr double MieShape<N, M>::c_rep;
+template <int N, int M> constexpr double MieShape<N, M>::c_att;
+template <int N, int M> constexpr double MieShape<N, M>::k;
+template <int N, int M> constexpr double MieShape<N, M>::k_rep;
+template <int N, int M> constexpr double MieShape<N, M>::k_att;
+
+typedef MieShape<12, 6> LJShape;
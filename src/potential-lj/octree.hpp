@@ -0,0 +1,333 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+
+#include "particle-arrays.hpp"
+#include "kernel.hpp"
+#include "mie-shape.hpp"
+#include "../util/ipow.hpp"
+
+// The far field of a cluster of Mie (or LJ) particles.
+//
+// Writing each term as  C_rep / r^N - C_att / r^M  (C_rep = c_rep eps r_m^N, C_att =
+//  c_att eps r_m^M; see mie-shape.hpp), the attraction is expanded to second order about
+//  the C_att-weighted centroid (where the first order term vanishes), using the totals of
+//  C_att and the second moment M of the C_att weights.  With d = point - centroid,
+//  u = |d|^2 and p = M/2,
+//
+//     E = C_rep u^-(N/2) - C_att u^-p + p tr(M) u^-(p+1) - 2p(p+1) (d.M.d) u^-(p+2)
+//
+//  (for LJ:  C12 u^-6 - C6 u^-3 + 3 tr(M) u^-4 - 24 (d.M.d) u^-5)
+//  where the repulsion, which dies off far sooner, is kept only to leading order.
+template <class T, class Shape = LJShape>
+struct LJCluster {
+	static const int N = Shape::repulsion_exponent;
+	static const int M = Shape::attraction_exponent;
+
+	std::array<T, 3> center {{0, 0, 0}};
+	T c_att = 0;
+	T c_rep = 0;
+	std::array<T, 6> moment {{0, 0, 0, 0, 0, 0}}; // xx, yy, zz, xy, xz, yz
+
+	T energy (T x, T y, T z) const
+	{
+		T dx = x - center[0], dy = y - center[1], dz = z - center[2];
+		T inv_u = T(1) / (dx*dx + dy*dy + dz*dz);
+		T inv_r = Shape::root(inv_u);
+		T p = T(M) / 2;
+		return c_rep * half_ipow<N>(inv_u, inv_r)
+			- c_att * half_ipow<M>(inv_u, inv_r)
+			+ p * trace() * half_ipow<M + 2>(inv_u, inv_r)
+			- 2 * p * (p + 1) * quadratic_form(dx, dy, dz) * half_ipow<M + 4>(inv_u, inv_r);
+	}
+
+	// Accumulates energy, force and (optionally) Hessian, like lj_evaluate_vec
+	void evaluate (T x, T y, T z, bool with_hessian, LJEvaluation<T> & out) const
+	{
+		T d[3] = {x - center[0], y - center[1], z - center[2]};
+		T inv_u = T(1) / (d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+		T inv_r = Shape::root(inv_u);
+
+		// u^-(K/2) for each K needed
+		T rep0 = half_ipow<N>(inv_u, inv_r);
+		T rep1 = rep0 * inv_u;
+		T rep2 = rep1 * inv_u;
+		T att0 = half_ipow<M>(inv_u, inv_r);
+		T att1 = att0 * inv_u, att2 = att1 * inv_u;
+		T att3 = att2 * inv_u, att4 = att3 * inv_u;
+
+		T p = T(M) / 2, n = T(N) / 2;
+		T a2 = 2 * p * (p + 1);  // coefficient of the quadrupole term
+
+		T tr = trace();
+		T q = quadratic_form(d[0], d[1], d[2]);
+		T md[3] = {
+			moment[0]*d[0] + moment[3]*d[1] + moment[4]*d[2],
+			moment[3]*d[0] + moment[1]*d[1] + moment[5]*d[2],
+			moment[4]*d[0] + moment[5]*d[1] + moment[2]*d[2],
+		};
+
+		// The terms depending on u alone have derivatives d1, d2 in u (as in kernel.hpp);
+		//  the last term is -a2 q u^-(p+2), with grad q = 2 M d.
+		T d1 = -n * c_rep * rep1 + p * c_att * att1 - p * (p + 1) * tr * att2;
+		T d2 = n * (n + 1) * c_rep * rep2 - p * (p + 1) * c_att * att2 + p * (p + 1) * (p + 2) * tr * att3;
+
+		out.energy += c_rep * rep0 - c_att * att0 + p * tr * att1 - a2 * q * att2;
+
+		T radial = 2 * d1 + 2 * a2 * (p + 2) * q * att3;
+		for (int a=0; a<3; a++)
+			out.force[a] -= radial * d[a] - 2 * a2 * att2 * md[a];
+
+		if (with_hessian) {
+			T m[3][3] = {
+				{moment[0], moment[3], moment[4]},
+				{moment[3], moment[1], moment[5]},
+				{moment[4], moment[5], moment[2]},
+			};
+			for (int a=0; a<3; a++) {
+				for (int b=a; b<3; b++) {
+					T h = (4 * d2 - 4 * a2 * (p + 2) * (p + 3) * q * att4) * d[a] * d[b]
+						- 2 * a2 * att2 * m[a][b]
+						+ 4 * a2 * (p + 2) * att3 * (d[a] * md[b] + md[a] * d[b]);
+					if (a == b)
+						h += radial;
+
+					out.hessian[a][b] += h;
+					if (b != a)
+						out.hessian[b][a] += h;
+				}
+			}
+		}
+	}
+
+	T trace () const { return moment[0] + moment[1] + moment[2]; }
+
+	T quadratic_form (T dx, T dy, T dz) const {
+		return moment[0]*dx*dx + moment[1]*dy*dy + moment[2]*dz*dz
+			+ 2 * (moment[3]*dx*dy + moment[4]*dx*dz + moment[5]*dy*dz);
+	}
+};
+
+template <class T, class Shape> const int LJCluster<T, Shape>::N;
+template <class T, class Shape> const int LJCluster<T, Shape>::M;
+
+// An octree over a set of Mie (or LJ) particles, for Barnes-Hut style evaluation of the full
+//  (uncut) potential.
+//
+// Every node summarizes its particles as an LJCluster.  A node whose particles all lie
+//  within `radius` of its centroid stands in for them at any point at a distance d with
+//  radius < theta * d; nearby nodes are opened, down to leaves which are summed exactly.
+//  As the expansion error of the cluster is third order, each cluster's relative error is
+//  on the order of theta^3 (in practice smaller, as particles rarely all sit at the edge).
+template <class T, class Shape = LJShape>
+class LJOctree {
+	public:
+		typedef std::array<T, 3> Point;
+		typedef LJCluster<T, Shape> Cluster;
+
+		// Builds the tree over a copy of the particles, arranged so that every node's
+		//  particles are contiguous.  Nodes with at most leaf_size particles are leaves.
+		// The clusters are summarized using the parameters in `row`, so the tree must be
+		//  rebuilt if those change.
+		void build (const LJParticleArrays<T> & particles, const LJPairRow<T> & row, std::size_t leaf_size=32)
+		{
+			std::size_t n = particles.size();
+
+			std::vector<std::size_t> order(n);
+			for (std::size_t i=0; i < n; i++)
+				order[i] = i;
+
+			_nodes.clear();
+			if (n > 0) {
+				// (cubic cells keep the clusters compact even for a thin slab)
+				Point lower, upper;
+				bounding_box(particles, order, 0, n, lower, upper);
+				T side = std::max(upper[0] - lower[0], std::max(upper[1] - lower[1], upper[2] - lower[2]));
+				for (int a=0; a<3; a++)
+					upper[a] = lower[a] + side;
+
+				_nodes.push_back(Node());
+				subdivide(particles, order, 0, 0, n, lower, upper, std::max<std::size_t>(leaf_size, 1), 0);
+			}
+
+			_particles.clear();
+			_particles.reserve(n);
+			for (std::size_t k=0; k < n; k++)
+				_particles.push_back_from(particles, order[k]);
+
+			for (auto & node : _nodes)
+				summarize(node, row);
+		}
+
+		// Calls near(span) for every leaf that must be summed exactly at the point (x,y,z),
+		//  and far(cluster) for every node that may be treated as a whole.
+		template <class Near, class Far>
+		void traverse (T x, T y, T z, T theta, Near && near, Far && far) const
+		{
+			if (_nodes.empty())
+				return;
+
+			T theta_sq = theta * theta;
+			auto all = _particles.span();
+
+			std::size_t stack[MAX_DEPTH * 7 + 1];
+			std::size_t top = 0;
+			stack[top++] = 0;
+			while (top > 0) {
+				const Node & node = _nodes[stack[--top]];
+
+				const Point & c = node.cluster.center;
+				T dx = x - c[0], dy = y - c[1], dz = z - c[2];
+				if (node.radius_sq < theta_sq * (dx*dx + dy*dy + dz*dz)) {
+					far(node.cluster);
+				} else if (node.num_children == 0) {
+					near(all.subspan(node.begin, node.end));
+				} else {
+					for (std::size_t c=0; c < node.num_children; c++)
+						stack[top++] = node.first_child + c;
+				}
+			}
+		}
+
+		std::size_t size () const { return _particles.size(); }
+		std::size_t num_nodes () const { return _nodes.size(); }
+
+	private:
+		struct Node {
+			std::size_t begin = 0, end = 0;      // range in _particles
+			std::size_t first_child = 0;         // children are contiguous in _nodes
+			std::size_t num_children = 0;        // 0 for a leaf
+			Cluster cluster;
+			T radius_sq = 0;                     // of the smallest sphere about the centroid holding every particle
+		};
+
+		// Subdivision stops at this depth no matter what, which also guards against
+		//  coincident particles.  (bounds the traversal stack)
+		static const std::size_t MAX_DEPTH = 48;
+
+		std::vector<Node> _nodes;
+		LJParticleArrays<T> _particles;
+
+		static void bounding_box (
+			const LJParticleArrays<T> & p, const std::vector<std::size_t> & order,
+			std::size_t begin, std::size_t end, Point & lower, Point & upper)
+		{
+			lower = upper = Point {{p.x()[order[begin]], p.y()[order[begin]], p.z()[order[begin]]}};
+			for (std::size_t k=begin; k < end; k++) {
+				Point q = {{p.x()[order[k]], p.y()[order[k]], p.z()[order[k]]}};
+				for (int a=0; a<3; a++) {
+					lower[a] = std::min(lower[a], q[a]);
+					upper[a] = std::max(upper[a], q[a]);
+				}
+			}
+		}
+
+		// Splits _nodes[index] (covering order[begin, end) inside the given box) into octants
+		void subdivide (
+			const LJParticleArrays<T> & p, std::vector<std::size_t> & order,
+			std::size_t index, std::size_t begin, std::size_t end,
+			Point lower, Point upper, std::size_t leaf_size, std::size_t depth)
+		{
+			_nodes[index].begin = begin;
+			_nodes[index].end = end;
+			// (a box of coincident particles can't be split)
+			if (end - begin <= leaf_size || depth >= MAX_DEPTH || lower == upper)
+				return;
+
+			Point mid;
+			for (int a=0; a<3; a++)
+				mid[a] = lower[a] + (upper[a] - lower[a]) / 2;
+
+			// partition into octants; octant o holds the upper half along axis a if bit a of o is set
+			const typename LJParticleArrays<T>::array_type * coords[3] = { &p.x(), &p.y(), &p.z() };
+			std::size_t bounds[9];
+			bounds[0] = begin;
+			bounds[8] = end;
+			auto split = [&] (std::size_t b, std::size_t e, int axis) {
+				return std::size_t(std::partition(order.begin() + b, order.begin() + e, [&] (std::size_t i) {
+					return (*coords[axis])[i] < mid[axis];
+				}) - order.begin());
+			};
+			bounds[4] = split(bounds[0], bounds[8], 2);
+			for (int h=0; h<8; h+=4) bounds[h+2] = split(bounds[h], bounds[h+4], 1);
+			for (int q=0; q<8; q+=2) bounds[q+1] = split(bounds[q], bounds[q+2], 0);
+
+			std::size_t first_child = _nodes.size();
+			std::array<std::size_t, 8> child_octant;
+			std::size_t num_children = 0;
+			for (int o=0; o<8; o++) {
+				if (bounds[o] != bounds[o+1]) {
+					child_octant[num_children++] = o;
+					_nodes.push_back(Node());
+				}
+			}
+			_nodes[index].first_child = first_child;
+			_nodes[index].num_children = num_children;
+
+			for (std::size_t c=0; c < num_children; c++) {
+				int o = child_octant[c];
+				Point child_lower, child_upper;
+				for (int a=0; a<3; a++) {
+					bool high = (o >> a) & 1;
+					child_lower[a] = high? mid[a] : lower[a];
+					child_upper[a] = high? upper[a] : mid[a];
+				}
+				subdivide(p, order, first_child + c, bounds[o], bounds[o+1], child_lower, child_upper, leaf_size, depth + 1);
+			}
+		}
+
+		// Computes the cluster and radius of a node
+		// (called once _particles is in tree order)
+		void summarize (Node & node, const LJPairRow<T> & row)
+		{
+			Cluster & cluster = node.cluster;
+
+			Point weighted {{0, 0, 0}};
+			for (std::size_t k=node.begin; k < node.end; k++) {
+				T w = attraction_weight(k, row);
+				LJSpeciesIndex s = _particles.species()[k];
+				T rm2 = row.length_unit_sq[s];
+				cluster.c_att += w;
+				cluster.c_rep += T(Shape::c_rep) * row.energy_unit[s] * half_ipow<Shape::repulsion_exponent>(rm2, Shape::root(rm2));
+				weighted[0] += w * _particles.x()[k];
+				weighted[1] += w * _particles.y()[k];
+				weighted[2] += w * _particles.z()[k];
+			}
+
+			if (cluster.c_att > 0) {
+				for (int a=0; a<3; a++)
+					cluster.center[a] = weighted[a] / cluster.c_att;
+			} else {
+				cluster.center = Point {{_particles.x()[node.begin], _particles.y()[node.begin], _particles.z()[node.begin]}};
+			}
+
+			for (std::size_t k=node.begin; k < node.end; k++) {
+				T dx = _particles.x()[k] - cluster.center[0];
+				T dy = _particles.y()[k] - cluster.center[1];
+				T dz = _particles.z()[k] - cluster.center[2];
+				node.radius_sq = std::max(node.radius_sq, dx*dx + dy*dy + dz*dz);
+
+				T w = attraction_weight(k, row);
+				cluster.moment[0] += w * dx * dx;
+				cluster.moment[1] += w * dy * dy;
+				cluster.moment[2] += w * dz * dz;
+				cluster.moment[3] += w * dx * dy;
+				cluster.moment[4] += w * dx * dz;
+				cluster.moment[5] += w * dy * dz;
+			}
+		}
+
+		// C_att of particle k
+		T attraction_weight (std::size_t k, const LJPairRow<T> & row) const
+		{
+			LJSpeciesIndex s = _particles.species()[k];
+			T rm2 = row.length_unit_sq[s];
+			return T(Shape::c_att) * row.energy_unit[s] * half_ipow<Shape::attraction_exponent>(rm2, Shape::root(rm2));
+		}
+};
+
+template <class T, class Shape> const std::size_t LJOctree<T, Shape>::MAX_DEPTH;
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include "particle-arrays.hpp"
+#include "species-table.hpp"
+#include "../numcomp.hpp"
+
+// A tabulated pair potential: for each species, its interaction with the probe as a cubic
+//  spline in u = r^2, on a uniform grid of `intervals` intervals spanning [u_min, u_max].
+//
+// A lookup costs a handful of multiply-adds and four gathers, no matter how expensive the
+//  function that was tabulated (Morse, Buckingham, damped dispersion...).  Each interval
+//  is a cubic Hermite segment through the function's values and (5-point finite
+//  difference) slopes at its ends, so the error falls off as intervals^-4.
+//
+// Below u_min the energy is held at its value at u_min; beyond u_max it is unspecified (the
+//  table is meant to be used under a cutoff of sqrt(u_max)).
+//
+// The table is small enough (4 * (intervals + 1) values per species) that a reasonable
+//  resolution stays in cache while the kernels gather from it.
+template <class T>
+class LJPairTable {
+	public:
+		typedef typename LJParticleArrays<T>::array_type array_type;
+
+		// The energy of a pair with the given parameters at squared distance u
+		typedef std::function<T(const LJParameters<T> &, T)> PairFunction;
+
+		// Tabulates f for the interaction of each species of `species` with its probe
+		// Throws std::invalid_argument if the table would hold more coefficients than it
+		//  can index exactly (see max_coefficients()).
+		void build (const LJSpeciesTable<T> & species, const PairFunction & f, T u_min, T u_max, std::size_t intervals)
+		{
+			intervals = std::max<std::size_t>(intervals, 1);
+			if (species.size() > 0 && intervals + 1 > max_coefficients() / (4 * species.size()))
+				throw std::invalid_argument("LJPairTable: too many species and intervals to index exactly");
+
+			_u_min = u_min;
+			_intervals = intervals;
+			_step = (u_max - u_min) / T(_intervals);
+			_inv_step = T(1) / _step;
+
+			// (one spare, zeroed interval at the end, which points beyond u_max may index)
+			std::size_t stride = _intervals + 1;
+			_coeffs.assign(4 * stride * species.size(), T(0));
+			_base.resize(species.size());
+			_max_error = 0;
+
+			for (std::size_t s=0; s < species.size(); s++) {
+				_base[s] = T(s * stride);
+				LJParameters<T> pair = species.with_probe(LJSpeciesIndex(s));
+				auto energy = [&] (T u) { return f(pair, u); };
+
+				// Hermite segments, with slopes in units of the step
+				T * c = &_coeffs[4 * s * stride];
+				T value = energy(u_min);
+				T slope = _step * derivative(energy, u_min);
+				for (std::size_t k=0; k < _intervals; k++) {
+					T u_next = u_min + T(k + 1) * _step;
+					T next_value = energy(u_next);
+					T next_slope = _step * derivative(energy, u_next);
+
+					c[4*k + 0] = value;
+					c[4*k + 1] = slope;
+					c[4*k + 2] = 3 * (next_value - value) - 2 * slope - next_slope;
+					c[4*k + 3] = 2 * (value - next_value) + slope + next_slope;
+
+					value = next_value;
+					slope = next_slope;
+				}
+
+				_max_error = std::max(_max_error, measure_error(LJSpeciesIndex(s), energy, u_max));
+			}
+		}
+
+		// Energy of species s at squared distance u (the scalar version of the kernels' lookup)
+		T energy (LJSpeciesIndex s, T u) const
+		{
+			T x = std::min(std::max((u - _u_min) * _inv_step, T(0)), T(_intervals));
+			T k = std::trunc(x);
+			T t = x - k;
+			const T * c = &_coeffs[4 * std::size_t(_base[s] + k)];
+			return c[0] + t * (c[1] + t * (c[2] + t * c[3]));
+		}
+
+		// Largest relative error found when the table was built, checked at the quarter
+		//  points of every interval.  The error is taken relative to |E|, or to |E(u_max)|
+		//  where that is larger (which keeps the measure finite through the zero crossing).
+		T max_error () const { return _max_error; }
+
+		// The most coefficients (4 per interval, plus a spare interval, per species) a table
+		//  may hold.  The kernels compute the index of a coefficient in T, from base(), and
+		//  gather through 32-bit integers, so every index must be exact in both: 2^24 for
+		//  float, 2^31 for double.
+		static std::size_t max_coefficients () {
+			return std::size_t(1) << std::min(std::numeric_limits<T>::digits, 31);
+		}
+
+		bool empty () const { return _coeffs.empty(); }
+		std::size_t intervals () const { return _intervals; }
+		std::size_t species_count () const { return _base.size(); }
+
+		T u_min () const { return _u_min; }
+		T inv_step () const { return _inv_step; }
+
+		// Coefficients of interval k for species s start at coeffs()[4 * (base()[s] + k)]
+		const T * coeffs () const { return _coeffs.data(); }
+		const T * base () const { return _base.data(); }
+
+	private:
+		T _u_min = 0;
+		T _step = 0;
+		T _inv_step = 0;
+		std::size_t _intervals = 0;
+		T _max_error = 0;
+
+		array_type _coeffs;  // c0 c1 c2 c3 of each interval, so that a lookup touches one line
+		array_type _base;    // first interval of each species (as T, for the SIMD kernels)
+
+		template <class F>
+		T derivative (F & energy, T u) const
+		{
+			// (keeping the stencil clear of u = 0)
+			T h = std::min(_step, u) / 8;
+			return differentiate_5point(energy, u, h);
+		}
+
+		template <class F>
+		T measure_error (LJSpeciesIndex s, F & energy, T u_max) const
+		{
+			T floor = std::fabs(energy(u_max));
+			T worst = 0;
+			for (std::size_t k=0; k < _intervals; k++) {
+				for (int q=1; q<4; q++) {
+					T u = _u_min + (T(k) + T(q) / 4) * _step;
+					T exact = energy(u);
+					T scale = std::max(std::fabs(exact), floor);
+					T error = std::fabs(this->energy(s, u) - exact);
+					if (error > 0)
+						worst = std::max(worst, error / scale);
+				}
+			}
+			return worst;
+		}
+};
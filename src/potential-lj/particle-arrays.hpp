@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "../util/aligned-allocator.hpp"
+
+// Index into an LJSpeciesTable.
+// (16 bits rather than 8, so that the per-particle add_particle API, which registers a
+//  species for each distinct parameter pair, keeps working for heterogeneous samples)
+typedef std::uint16_t LJSpeciesIndex;
+
+// The parameters of each species' interaction with the probe, indexed by species.
+// This is a view into the row of an LJSpeciesTable selected by the probe; it is small
+//  enough to stay resident in L1 while the kernels gather from it.
+template <class T>
+struct LJPairRow {
+	const T * energy_unit;    // $\epsilon$
+	const T * length_unit_sq; // $r_m^2$  (the kernels never need $r_m$ itself)
+};
+
+// A read-only window onto a structure-of-arrays block of LJ particles.
+// This is what the kernels operate on; it is cheap to copy and may refer to any
+//  contiguous sub-range of an LJParticleArrays.
+template <class T>
+struct LJParticleSpan {
+	const T * x;
+	const T * y;
+	const T * z;
+	const LJSpeciesIndex * species;
+	std::size_t size;
+
+	LJParticleSpan subspan (std::size_t begin, std::size_t end) const {
+		return LJParticleSpan {
+			x + begin, y + begin, z + begin,
+			species + begin,
+			end - begin,
+		};
+	}
+};
+
+// Structure-of-arrays storage for LJ particles: positions, plus a species index for
+//  looking up the interaction parameters in an LJPairRow.
+// Each array is 64-byte aligned so that SIMD loads start on a cache line.
+template <class T>
+class LJParticleArrays {
+	public:
+		typedef std::vector<T, AlignedAllocator<T, 64>> array_type;
+		typedef std::vector<LJSpeciesIndex, AlignedAllocator<LJSpeciesIndex, 64>> species_array_type;
+
+		void push_back (T x, T y, T z, LJSpeciesIndex species) {
+			_x.push_back(x);
+			_y.push_back(y);
+			_z.push_back(z);
+			_species.push_back(species);
+		}
+
+		// Copies particle i of another block onto the end of this one
+		void push_back_from (const LJParticleArrays & other, std::size_t i) {
+			push_back(other._x[i], other._y[i], other._z[i], other._species[i]);
+		}
+
+		void set_position (std::size_t i, T x, T y, T z) {
+			_x[i] = x;
+			_y[i] = y;
+			_z[i] = z;
+		}
+
+		// Removes particle i, moving those after it down by one
+		void erase (std::size_t i) {
+			_x.erase(_x.begin() + i);
+			_y.erase(_y.begin() + i);
+			_z.erase(_z.begin() + i);
+			_species.erase(_species.begin() + i);
+		}
+
+		// Rearranges the particles so that the new i-th particle is the old order[i]-th
+		//  (order must be a permutation)
+		void permute (const std::vector<std::size_t> & order) {
+			LJParticleArrays result;
+			result.reserve(order.size());
+			for (std::size_t k=0; k < order.size(); k++)
+				result.push_back_from(*this, order[k]);
+			*this = std::move(result);
+		}
+
+		void reserve (std::size_t n) {
+			_x.reserve(n);
+			_y.reserve(n);
+			_z.reserve(n);
+			_species.reserve(n);
+		}
+
+		void clear () {
+			_x.clear();
+			_y.clear();
+			_z.clear();
+			_species.clear();
+		}
+
+		std::size_t size () const { return _x.size(); }
+
+		LJParticleSpan<T> span () const {
+			return LJParticleSpan<T> {
+				_x.data(), _y.data(), _z.data(),
+				_species.data(),
+				size(),
+			};
+		}
+
+		const array_type & x () const { return _x; }
+		const array_type & y () const { return _y; }
+		const array_type & z () const { return _z; }
+		const species_array_type & species () const { return _species; }
+
+	private:
+		array_type _x;
+		array_type _y;
+		array_type _z;
+		species_array_type _species;
+
+		// invariant: all arrays have the same length
+};
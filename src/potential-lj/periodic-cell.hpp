@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <stdexcept>
+
+#include "particle-arrays.hpp"
+
+// Lattice vectors of a periodic system, along with which of them are actually periodic.
+// (the typical case is a slab: periodic along a and b, with vacuum along c)
+//
+// Periodic images are never materialized; instead, LJPotential asks this class for the
+//  range of lattice translations whose images of the sample can possibly lie within some
+//  radius of a point, and evaluates the unshifted particles at correspondingly shifted
+//  points.
+template <class T>
+class LJPeriodicCell {
+	public:
+		typedef std::array<T, 3> Vector;
+
+		LJPeriodicCell ()
+		: _periodic {{false, false, false}}
+		, _vectors {{ {{1, 0, 0}}, {{0, 1, 0}}, {{0, 0, 1}} }}
+		{
+			compute_inverse();
+		}
+
+		LJPeriodicCell (Vector a, Vector b, Vector c, std::array<bool, 3> periodic)
+		: _periodic(periodic)
+		, _vectors {{ a, b, c }}
+		{
+			compute_inverse();
+		}
+
+		bool periodic (int axis) const { return _periodic[axis]; }
+		bool any_periodic () const { return _periodic[0] || _periodic[1] || _periodic[2]; }
+
+		const Vector & vector (int axis) const { return _vectors[axis]; }
+
+		// Coefficients f such that point = f[0]*a + f[1]*b + f[2]*c
+		Vector fractional (const Vector & point) const {
+			Vector f;
+			for (int a=0; a<3; a++)
+				f[a] = _inverse[a][0]*point[0] + _inverse[a][1]*point[1] + _inverse[a][2]*point[2];
+			return f;
+		}
+
+		// n[0]*a + n[1]*b + n[2]*c
+		Vector translation (long n0, long n1, long n2) const {
+			Vector t;
+			for (int k=0; k<3; k++)
+				t[k] = n0*_vectors[0][k] + n1*_vectors[1][k] + n2*_vectors[2][k];
+			return t;
+		}
+
+		// Distance between the two lattice planes spanned by the *other* two vectors;
+		// i.e. a sphere of radius r spans r / width(axis) cells along this axis.
+		T width (int axis) const {
+			Vector cross = cross_product(_vectors[(axis+1)%3], _vectors[(axis+2)%3]);
+			return std::fabs(_determinant) / norm(cross);
+		}
+
+		// Area of the face spanned by the two vectors other than `axis`
+		T face_area (int axis) const {
+			return norm(cross_product(_vectors[(axis+1)%3], _vectors[(axis+2)%3]));
+		}
+
+		// Range [first, last] of translations n along `axis` for which the sample (whose
+		//  fractional coordinates along the axis lie in [lo, hi]), shifted by n cells, may
+		//  come within `radius` of a point with fractional coordinate f.
+		// Non-periodic axes always get [0, 0].
+		void image_range (int axis, T f, T radius, T lo, T hi, long & first, long & last) const {
+			if (!_periodic[axis]) {
+				first = last = 0;
+				return;
+			}
+			T reach = radius / width(axis);
+			first = long(std::ceil(f - reach - hi));
+			last  = long(std::floor(f + reach - lo));
+		}
+
+	private:
+		std::array<bool, 3>   _periodic;
+		std::array<Vector, 3> _vectors;
+		std::array<Vector, 3> _inverse; // rows map cartesian -> fractional
+		T _determinant;
+
+		static Vector cross_product (const Vector & u, const Vector & v) {
+			return {{ u[1]*v[2] - u[2]*v[1], u[2]*v[0] - u[0]*v[2], u[0]*v[1] - u[1]*v[0] }};
+		}
+
+		static T norm (const Vector & u) {
+			return std::sqrt(u[0]*u[0] + u[1]*u[1] + u[2]*u[2]);
+		}
+
+		void compute_inverse () {
+			// Columns of the matrix are the lattice vectors, so the rows of its inverse
+			//  are the reciprocal vectors (b x c, c x a, a x b) / det.
+			_determinant = 0;
+			Vector bc = cross_product(_vectors[1], _vectors[2]);
+			for (int k=0; k<3; k++)
+				_determinant += _vectors[0][k] * bc[k];
+
+			if (_determinant == 0)
+				throw std::invalid_argument("LJPeriodicCell: lattice vectors are linearly dependent");
+
+			for (int a=0; a<3; a++) {
+				Vector row = cross_product(_vectors[(a+1)%3], _vectors[(a+2)%3]);
+				for (int k=0; k<3; k++)
+					_inverse[a][k] = row[k] / _determinant;
+			}
+		}
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+#include "particle-arrays.hpp"
+#include "mie-shape.hpp"
+#include "../util/ipow.hpp"
+
+#ifndef PI
+#define PI 3.14159265358979323846
+#endif
+
+// Mean-field estimate of the r^-M dispersion that a cutoff throws away.
+//
+// The model treats the particles as a laterally homogeneous slab: the attraction
+//  coefficient C = c_att * epsilon * r_m^M of every particle (C6 = 2 epsilon r_m^6 for
+//  LJ; see mie-shape.hpp) is smeared uniformly over the lateral area and over the slab's
+//  thickness [z_lo, z_hi].  The dispersion from a plane at height h relative to the probe,
+//  excluding the sphere r < r_c, integrates to
+//
+//     g(h) = 2 pi / (M-2) * max(r_c, |h|)^(2-M)     (per unit areal density)
+//
+//  which in turn integrates over the thickness in closed form, so the correction costs a
+//  handful of flops per evaluation.  The repulsive r^-N tail is neglected.
+//
+// The model is exact-in-the-mean for an infinite (or periodic) slab.  Near the lateral
+//  edges of a finite sample it overestimates the missing attraction.
+template <class T, class Shape = LJShape>
+class LJSlabTail {
+	static const int M = Shape::attraction_exponent;
+	static_assert(M > 3, "the dispersion of a slab only converges for M > 3");
+
+	public:
+		// Takes the total C from the particles, and the thickness from their z extent.
+		// The lateral area must be supplied by the caller (bounding box, periodic cell...).
+		void build (const LJParticleArrays<T> & particles, const LJPairRow<T> & row, T lateral_area)
+		{
+			T c = 0;
+			for (std::size_t i=0; i < particles.size(); i++) {
+				LJSpeciesIndex s = particles.species()[i];
+				T rm2 = row.length_unit_sq[s];
+				c += T(Shape::c_att) * row.energy_unit[s] * half_ipow<M>(rm2, Shape::root(rm2));
+			}
+
+			if (particles.size() == 0 || !(lateral_area > 0)) {
+				// no meaningful density; disable the correction
+				_areal_c = 0;
+				_z_lo = _z_hi = 0;
+				return;
+			}
+
+			auto minmax = std::minmax_element(particles.z().begin(), particles.z().end());
+			_areal_c = c / lateral_area;
+			_z_lo = *minmax.first;
+			_z_hi = *minmax.second;
+		}
+
+		// Missing energy for a probe at height z (always <= 0)
+		T energy (T z, T cutoff) const
+		{
+			if (_areal_c == 0)
+				return 0;
+
+			T a = _z_lo - z;
+			T b = _z_hi - z;
+			T thickness = b - a;
+
+			// (a monolayer is the limit of a vanishing thickness)
+			if (thickness <= MIN_THICKNESS * cutoff)
+				return -_areal_c * plane(a, cutoff);
+			return -_areal_c * (antiderivative(b, cutoff) - antiderivative(a, cutoff)) / thickness;
+		}
+
+		// d/dz and d^2/dz^2 of energy()
+		T derivative (T z, T cutoff) const
+		{
+			if (_areal_c == 0)
+				return 0;
+
+			T a = _z_lo - z;
+			T b = _z_hi - z;
+			T thickness = b - a;
+
+			if (thickness <= MIN_THICKNESS * cutoff)
+				return _areal_c * plane_derivative(a, cutoff);
+			return _areal_c * (plane(b, cutoff) - plane(a, cutoff)) / thickness;
+		}
+
+		T second_derivative (T z, T cutoff) const
+		{
+			if (_areal_c == 0)
+				return 0;
+
+			T a = _z_lo - z;
+			T b = _z_hi - z;
+			T thickness = b - a;
+
+			if (thickness <= MIN_THICKNESS * cutoff)
+				return -_areal_c * plane_second_derivative(a, cutoff);
+			return _areal_c * (plane_derivative(a, cutoff) - plane_derivative(b, cutoff)) / thickness;
+		}
+
+		// Worst-case magnitude of the missing energy over all probe heights, for a given cutoff.
+		// This is bounded both by the full-space result (for thick slabs) and by the
+		//  plane result at contact (for thin ones).
+		T bound (T cutoff) const
+		{
+			T thickness = _z_hi - _z_lo;
+
+			T thin = 2 * T(PI) / (M - 2) * ipow<2 - M>(cutoff);
+			if (thickness <= MIN_THICKNESS * cutoff)
+				return _areal_c * thin;
+
+			T thick = 4 * T(PI) / ((M - 3) * thickness) * ipow<3 - M>(cutoff);
+			return _areal_c * std::min(thin, thick);
+		}
+
+		// Smallest cutoff for which bound(cutoff) <= tolerance (the inverse of bound())
+		T cutoff_for (T tolerance) const
+		{
+			if (_areal_c == 0)
+				return 0;
+
+			T thin = std::pow(2 * T(PI) * _areal_c / ((M - 2) * tolerance), T(1) / (M - 2));
+			T thickness = _z_hi - _z_lo;
+			if (thickness <= 0)
+				return thin;
+
+			T thick = std::pow(4 * T(PI) * _areal_c / ((M - 3) * thickness * tolerance), T(1) / (M - 3));
+			return std::min(thin, thick);
+		}
+
+		T areal_coefficient () const { return _areal_c; }
+
+	private:
+		T _areal_c = 0; // sum of C per unit lateral area
+		T _z_lo = 0;
+		T _z_hi = 0;
+
+		static constexpr double MIN_THICKNESS = 1E-6; // relative to the cutoff
+
+		// g(h) from the header comment
+		static T plane (T h, T cutoff) {
+			T m = std::max(cutoff, std::fabs(h));
+			return 2 * T(PI) / (M - 2) * ipow<2 - M>(m);
+		}
+
+		// dg/dh and d^2g/dh^2  (g is flat inside the cutoff)
+		static T plane_derivative (T h, T cutoff) {
+			if (std::fabs(h) <= cutoff)
+				return 0;
+			T sign = (h < 0)? -1 : 1;
+			return -2 * T(PI) * sign * ipow<1 - M>(std::fabs(h));
+		}
+
+		static T plane_second_derivative (T h, T cutoff) {
+			if (std::fabs(h) <= cutoff)
+				return 0;
+			return 2 * T(PI) * (M - 1) * ipow<-M>(std::fabs(h));
+		}
+
+		// integral of g from 0 to h
+		static T antiderivative (T h, T cutoff) {
+			T ah  = std::fabs(h);
+			T sign = (h < 0)? -1 : 1;
+
+			if (ah <= cutoff)
+				return sign * plane(cutoff, cutoff) * ah;
+			return sign * 2 * T(PI) / ((M - 2) * (M - 3)) * ((M - 2) * ipow<3 - M>(cutoff) - ipow<3 - M>(ah));
+		}
+};
+
+template <class T, class Shape> const int LJSlabTail<T, Shape>::M;
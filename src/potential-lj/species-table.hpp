@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cmath>
+#include <map>
+#include <limits>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <functional>
+
+#include "particle-arrays.hpp"
+
+// LJ parameters, either of a single species or of an interacting pair
+template <class T>
+struct LJParameters {
+	T energy_unit; // $\epsilon$
+	T length_unit; // $r_m$
+};
+
+// The species of a sample and the probe, and the LJ parameters of every pair of them.
+//
+// Each species has parameters of its own; those of a pair come from a mixing rule
+//  (Lorentz-Berthelot by default), unless set explicitly with set_pair().
+// With no probe species selected, a species' own parameters are taken to describe its
+//  interaction with the probe as-is.  (this is the meaning of the per-particle parameters
+//  of LJPotential::add_particle)
+//
+// Only the row of the table for the probe is ever used, so that is all that is stored
+//  densely; see probe_row().
+template <class T>
+class LJSpeciesTable {
+	public:
+		typedef LJParameters<T> Parameters;
+		typedef std::function<Parameters(const Parameters &, const Parameters &)> MixingRule;
+
+		static const LJSpeciesIndex NO_PROBE = std::numeric_limits<LJSpeciesIndex>::max();
+		static const std::size_t MAX_SPECIES = NO_PROBE;
+
+		// eps = sqrt(eps_a eps_b),  r_m = (r_a + r_b) / 2
+		static Parameters lorentz_berthelot (const Parameters & a, const Parameters & b) {
+			return Parameters { std::sqrt(a.energy_unit * b.energy_unit), (a.length_unit + b.length_unit) / 2 };
+		}
+
+		// eps = sqrt(eps_a eps_b),  r_m = sqrt(r_a r_b)
+		static Parameters geometric (const Parameters & a, const Parameters & b) {
+			return Parameters { std::sqrt(a.energy_unit * b.energy_unit), std::sqrt(a.length_unit * b.length_unit) };
+		}
+
+		LJSpeciesTable ()
+		: _mixing_rule(lorentz_berthelot)
+		{ }
+
+		// Registers a species, returning its index.
+		LJSpeciesIndex add_species (T energy_unit, T length_unit)
+		{
+			if (size() >= MAX_SPECIES)
+				throw std::length_error("LJSpeciesTable: too many species");
+
+			LJSpeciesIndex index = LJSpeciesIndex(size());
+			_species.push_back(Parameters {energy_unit, length_unit});
+			_lookup.insert(std::make_pair(std::make_pair(energy_unit, length_unit), index));
+			append_to_row(index);
+			return index;
+		}
+
+		// The first species registered with exactly these parameters, adding it if necessary.
+		LJSpeciesIndex find_or_add_species (T energy_unit, T length_unit)
+		{
+			auto it = _lookup.find(std::make_pair(energy_unit, length_unit));
+			if (it != _lookup.end())
+				return it->second;
+			return add_species(energy_unit, length_unit);
+		}
+
+		bool contains (T energy_unit, T length_unit) const
+		{
+			return _lookup.count(std::make_pair(energy_unit, length_unit)) != 0;
+		}
+
+		std::size_t size () const { return _species.size(); }
+
+		const Parameters & species (LJSpeciesIndex s) const { return _species.at(s); }
+
+		// These use the named parameter idiom
+
+		LJSpeciesTable & set_mixing_rule (MixingRule rule)
+		{
+			_mixing_rule = rule;
+			rebuild_row();
+			return *this;
+		}
+
+		// Overrides the mixing rule for one pair (in either order)
+		LJSpeciesTable & set_pair (LJSpeciesIndex a, LJSpeciesIndex b, T energy_unit, T length_unit)
+		{
+			check_index(a);
+			check_index(b);
+			_overrides[ordered(a, b)] = Parameters {energy_unit, length_unit};
+			rebuild_row();
+			return *this;
+		}
+
+		LJSpeciesTable & set_probe (LJSpeciesIndex probe)
+		{
+			check_index(probe);
+			_probe = probe;
+			rebuild_row();
+			return *this;
+		}
+
+		LJSpeciesTable & clear_probe ()
+		{
+			_probe = NO_PROBE;
+			rebuild_row();
+			return *this;
+		}
+
+		bool has_probe () const { return _probe != NO_PROBE; }
+		LJSpeciesIndex probe () const { return _probe; }
+
+		// Parameters of the interaction between two species
+		Parameters pair (LJSpeciesIndex a, LJSpeciesIndex b) const
+		{
+			auto it = _overrides.find(ordered(a, b));
+			if (it != _overrides.end())
+				return it->second;
+			return _mixing_rule(species(a), species(b));
+		}
+
+		// Parameters of the interaction between the probe and species s
+		Parameters with_probe (LJSpeciesIndex s) const
+		{
+			return has_probe()? pair(_probe, s) : species(s);
+		}
+
+		// with_probe() for every species, in the form used by the kernels.
+		// (invalidated by any change to the table)
+		LJPairRow<T> probe_row () const
+		{
+			return LJPairRow<T> { _row_energy_unit.data(), _row_length_unit_sq.data() };
+		}
+
+	private:
+		typedef typename LJParticleArrays<T>::array_type array_type;
+
+		std::vector<Parameters> _species;
+		std::map<std::pair<T, T>, LJSpeciesIndex> _lookup; // for find_or_add_species
+		std::map<std::pair<LJSpeciesIndex, LJSpeciesIndex>, Parameters> _overrides;
+		MixingRule _mixing_rule;
+		LJSpeciesIndex _probe = NO_PROBE;
+
+		array_type _row_energy_unit;
+		array_type _row_length_unit_sq;
+
+		void check_index (LJSpeciesIndex s) const {
+			if (s >= size())
+				throw std::out_of_range("LJSpeciesTable: no such species");
+		}
+
+		static std::pair<LJSpeciesIndex, LJSpeciesIndex> ordered (LJSpeciesIndex a, LJSpeciesIndex b) {
+			return (a < b)? std::make_pair(a, b) : std::make_pair(b, a);
+		}
+
+		void append_to_row (LJSpeciesIndex s) {
+			Parameters p = with_probe(s);
+			_row_energy_unit.push_back(p.energy_unit);
+			_row_length_unit_sq.push_back(p.length_unit * p.length_unit);
+		}
+
+		void rebuild_row () {
+			_row_energy_unit.clear();
+			_row_length_unit_sq.clear();
+			for (std::size_t s=0; s < size(); s++)
+				append_to_row(LJSpeciesIndex(s));
+		}
+};
+
+template <class T> const LJSpeciesIndex LJSpeciesTable<T>::NO_PROBE;
+template <class T> const std::size_t    LJSpeciesTable<T>::MAX_SPECIES;
@@ -1,191 +1,746 @@
 #pragma once
 
 #include <vector>
+#include <array>
 #include <chrono>
 #include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
 
 #include <Eigen/Dense>
 
 #include "lattice.hpp"
+#include "util/parallel.hpp"
+#include "util/ipow.hpp"
+#include "util/simd.hpp"
+#include "util/aligned-allocator.hpp"
+#include "util/mapped-file.hpp"
 
 // FIXME: `using` in header = badness
 using namespace Eigen;
 
+// How the (z0, c6, c12) of each column are fit.
+//
+//   Linear              c6 and c12 by linear least squares, with z0 held at 0.  One matrix
+//                        product for the whole lattice, but blind to a shifted z0.
+//   GaussNewton         the full nonlinear fit by Gauss-Newton.  Fast once it is close, but
+//                        undamped, so it can wander off from a poor start.
+//   LevenbergMarquardt  the nonlinear fit with Marquardt's damping, which falls back toward
+//                        small gradient steps wherever a full Gauss-Newton step would make
+//                        the fit worse.  Never increases the error, at the cost of some
+//                        extra solves.
+//   Hybrid              the Linear fit, then Gauss-Newton starting from each column's linear
+//                        solution (in place of LJFitSeeding).
+enum class LJFitMethod { Linear, GaussNewton, LevenbergMarquardt, Hybrid };
+
+// Where each column's nonlinear iteration starts.
+//
+//   Fixed         from the same guess everywhere.  Wasteful, but every column is fit
+//                  independently of the others.
+//   Continuation  the columns are visited in snake order (along each row, alternating
+//                  direction), each starting from the solution of the neighbor just fit.
+//                  Neighbors have nearly the same parameters, so most columns converge in
+//                  a step or two.  Inherently serial.
+//   Coarse        every COARSE_FIT_STRIDE-th column along each axis is fit from the fixed
+//                  guess first, and each of the rest then starts from the nearest of those.
+//                  Both passes run in parallel, at some cost in iterations compared to
+//                  Continuation.
+// A column whose fit runs away from its seed is refit from the fixed guess.
+enum class LJFitSeeding { Fixed, Continuation, Coarse };
+
+const std::size_t COARSE_FIT_STRIDE = 4;
+
+// How LJPseudoPotential gets (z0, c6, c12) between the (x,y) points it was fit at.
+//
+//   Nearest  those of the nearest point.  Blocky, unless the fit was made on a grid much
+//             finer than the images drawn from it.
+//   Bicubic  a bicubic patch per cell of the grid, which matches the fitted values (and
+//             finite difference estimates of their derivatives) at the cell's corners, so
+//             that the parameters vary smoothly from cell to cell.  The patches are built
+//             once, after the fit, so each lookup costs a fixed 3 x 16 multiply-adds.
+enum class LJInterpolation { Nearest, Bicubic };
+
+// Settings for LJPseudoPotential::fit_to_data (named parameter idiom)
 template <class T>
-class LJPseudoPotential {
+class LJFitOptions {
 	public:
+		LJFitOptions & set_method(LJFitMethod method) { _method = method; return *this; }
+		LJFitOptions & set_seeding(LJFitSeeding seeding) { _seeding = seeding; return *this; }
 
-		LJPseudoPotential(std::size_t d1, std::size_t d2)
-		: z0(d1, d2)
-		, coeff6(d1, d2)
-		, coeff12(d1, d2)
+		// The nonlinear fits stop once the square sum error changes by less than `tolerance`,
+		//  or by less than `relative_tolerance` times itself (0 = never), whichever comes first
+		LJFitOptions & set_tolerance(T tolerance) { _tolerance = tolerance; return *this; }
+		LJFitOptions & set_relative_tolerance(T tolerance) { _relative_tolerance = tolerance; return *this; }
+
+		// ...or else gives up after this many least squares solves
+		LJFitOptions & set_max_iterations(std::size_t max) { _max_iterations = max; return *this; }
+
+		// 0 = one per hardware thread
+		LJFitOptions & set_threads(unsigned threads) { _threads = threads; return *this; }
+
+		LJFitMethod method() const { return _method; }
+		LJFitSeeding seeding() const { return _seeding; }
+		T tolerance() const { return _tolerance; }
+		T relative_tolerance() const { return _relative_tolerance; }
+		std::size_t max_iterations() const { return _max_iterations; }
+		unsigned threads() const { return _threads; }
+
+	private:
+		LJFitMethod _method = LJFitMethod::GaussNewton;
+		LJFitSeeding _seeding = LJFitSeeding::Fixed;
+		T _tolerance = 1E-9;
+		T _relative_tolerance = 0;
+		std::size_t _max_iterations = 100;
+		unsigned _threads = 0;
+};
+
+// How the fit of a column ended.
+//
+//   Converged       the error stopped changing (within the tolerances)
+//   Exact           the error reached zero
+//   Stalled         (LevenbergMarquardt) no step, however damped, reduced the error any further
+//   IterationLimit  gave up after max_iterations solves
+//   Diverged        the error became infinite or NaN
+//   Direct          (Linear) solved directly, without iterating
+enum class LJFitStatus { Converged, Exact, Stalled, IterationLimit, Diverged, Direct };
+
+// Per-column record of how a fit went, laid out like the fit's coefficient lattices,
+//  for finding the regions that are slow or troublesome to fit.
+template <class T>
+class LJFitDiagnostics {
+	public:
+		LJFitDiagnostics()
+		: iterations(1, 1), residual(1, 1)
 		{ }
 
+		explicit LJFitDiagnostics(const Lattice2<T> & shape)
+		: iterations(make_similar_lattice<T>(shape))
+		, residual(make_similar_lattice<T>(shape))
+		, _status(shape.size(), LJFitStatus::Direct)
+		{ }
 
-		#ifdef PP_LINEAR
-		// Original version, which is far simpler (a linear regression).
-		// It's here so I can compare output, and should be removed in the future.
-		static LJPseudoPotential fit_to_data(Lattice3<T> potential)
+		// Least squares solves made for each column (including any that were rejected or
+		//  abandoned along the way)
+		Lattice2<T> iterations;
+
+		// Square sum error of each column's final fit
+		Lattice2<T> residual;
+
+		LJFitStatus status(std::size_t i, std::size_t j) const { return _status[i * iterations.size_1() + j]; }
+		void set_status(std::size_t i, std::size_t j, LJFitStatus status) { _status[i * iterations.size_1() + j] = status; }
+
+		// Number of columns whose fit ended with the given status
+		std::size_t count(LJFitStatus status) const { return std::count(_status.begin(), _status.end(), status); }
+
+		T mean_iterations() const
 		{
-			LJPseudoPotential result {potential.axis_size(0), potential.axis_size(1)};
+			T sum = 0;
+			for (std::size_t i=0; i < iterations.size_0(); i++)
+				for (std::size_t j=0; j < iterations.size_1(); j++)
+					sum += iterations(i, j);
+			return sum / T(iterations.size());
+		}
 
-			// make coeff lattices in the shape of the x & y dimensions of potential
-			result.z0      = make_sub_lattice<T>(potential, 0, 1);
-			result.coeff6  = make_sub_lattice<T>(potential, 0, 1);
-			result.coeff12 = make_sub_lattice<T>(potential, 0, 1);
+	private:
+		std::vector<LJFitStatus> _status;
+};
 
-			// Collect z-coordinates of data set
-			Array<T, Dynamic, 1> zarr {potential.size_2(), 1};
-			for (std::size_t k=0; k < potential.size_2(); k++) {
-				zarr(k) = potential.coord(2,k);
+// Scratch space for fitting (z0, c6, c12) to the potential along a single column of n
+//  heights, by Gauss-Newton or Levenberg-Marquardt, as set out by the options it was made
+//  with (method, tolerances and iteration limit).  Hybrid iterates like GaussNewton; there
+//  is nothing to iterate for Linear, which is refused with std::invalid_argument.
+// Every buffer, including those of the QR factorization, is sized once up front, so that
+//  fitting column after column with the same workspace performs no heap allocation at all.
+template <class T>
+class LJFitWorkspace {
+	public:
+		typedef Array<T, Dynamic, 1> ArrayType;
+		typedef Matrix<T, Dynamic, 3> JacobianType;
+
+		explicit LJFitWorkspace(std::size_t n, const LJFitOptions<T> & options = LJFitOptions<T>())
+		: values(n, 1)
+		, n(n), options(options)
+		, inv(n, 1), inv6(n, 1), inv12(n, 1)
+		, errors(n + 3, 1), rhs(n + 3, 1)
+		, jacobian(n + 3, 3)
+		, base_errors(n, 1)
+		, base_jacobian(n, 3)
+		{
+			if (options.method() == LJFitMethod::Linear)
+				throw std::invalid_argument("LJFitWorkspace: the linear fit is not iterative");
+		}
+
+		// The data to fit (filled in by the caller)
+		ArrayType values;
+
+		// The starting point used when nothing better is known
+		static Matrix<T, 3, 1> default_guess()
+		{
+			Matrix<T, 3, 1> guess;
+			guess << 0.05, -1., +1.;
+			return guess;
+		}
+
+		// Fits `values` at heights z, which must have the size the workspace was made for
+		Matrix<T, 3, 1> fit(const ArrayType & z)
+		{
+			_iterations = 0;
+			return iterate(z, default_guess());
+		}
+
+		// Fits `values` at heights z, starting from `seed` (z0, c6, c12).
+		// Gauss-Newton is undamped, so from a seed that is too far off it can run away
+		//  instead of converging.  If the seed isn't finite, or the fit ends up worse than
+		//  the seed itself, the fit is redone from the default guess.
+		Matrix<T, 3, 1> fit(const ArrayType & z, const Matrix<T, 3, 1> & seed)
+		{
+			_iterations = 0;
+			if (seed.allFinite()) {
+				Matrix<T, 3, 1> result = iterate(z, seed);
+				if (_final_sqsum <= _initial_sqsum)
+					return result;
 			}
+			return iterate(z, default_guess());
+		}
 
-			// Generate coefficient matrix
-			Matrix<T, Dynamic, 2> xmat {potential.size_2(), 2};
-			xmat.col(0) = zarr.pow(-6);
-			xmat.col(1) = zarr.pow(-12);
+		// Number of least squares solves performed by the last fit (including any for a
+		//  seed that was abandoned, and any steps that Levenberg-Marquardt rejected)
+		std::size_t iterations() const { return _iterations; }
 
-			// Generate least squares system solver
-			auto solver = xmat.colPivHouseholderQr();
+		// Square sum error of the last fit, and how it ended
+		T residual() const { return _final_sqsum; }
+		LJFitStatus status() const { return _status; }
 
-			// Solve for a best fit along z at each (x,y)
-			for (std::size_t i=0; i < potential.size_0(); i++) {
-				for (std::size_t j=0; j < potential.size_1(); j++) {
+	private:
+		Index n;
+		LJFitOptions<T> options;
+		ArrayType inv, inv6, inv12;
+		Matrix<T, Dynamic, 1> errors;    // (the last 3 rows are for damping)
+		Matrix<T, Dynamic, 1> rhs;
+		JacobianType jacobian;
+		Matrix<T, Dynamic, 1> base_errors;  // (LM: errors and jacobian at the current guess)
+		JacobianType base_jacobian;
+		std::size_t _iterations = 0;
+		T _initial_sqsum = 0;
+		T _final_sqsum = 0;
+		LJFitStatus _status = LJFitStatus::Converged;
+
+		// Largest number of times in a row that LM raises its damping before giving up
+		static const int MAX_REJECTIONS = 16;
+
+		Matrix<T, 3, 1> iterate(const ArrayType & z, const Matrix<T, 3, 1> & guess)
+		{
+			if (options.method() == LJFitMethod::LevenbergMarquardt)
+				return levenberg_marquardt(z, guess);
+			return gauss_newton(z, guess);
+		}
+
+		// Whether a change in the square sum error is small enough to stop at
+		bool converged(T change, T sqsum) const
+		{
+			return change < options.tolerance() || change < options.relative_tolerance() * sqsum;
+		}
+
+		// The errors (data minus model) at `guess` into the first n rows of `errors`, leaving
+		//  the powers of 1/(z - z0) behind for differentiate().  Returns their square sum.
+		T evaluate(const ArrayType & z, const Matrix<T, 3, 1> & guess)
+		{
+			// Powers of 1/(z - z0), by multiplication from the one reciprocal
+			inv   = (z - guess(0,0)).inverse();
+			inv6  = inv.cube().square();
+			inv12 = inv6.square();
+
+			errors.head(n) = (values - guess(1,0) * inv6 - guess(2,0) * inv12).matrix();
+			return errors.head(n).squaredNorm();
+		}
+
+		// Derivatives of the potential with respect to each fit parameter, at the guess
+		//  last evaluated, into the first n rows of `jacobian`
+		void differentiate(const Matrix<T, 3, 1> & guess)
+		{
+			jacobian.col(0).head(n) = ((6. * guess(1,0) * inv6 + 12. * guess(2,0) * inv12) * inv).matrix();
+			jacobian.col(1).head(n) = inv6.matrix();
+			jacobian.col(2).head(n) = inv12.matrix();
+		}
+
+		Matrix<T, 3, 1> gauss_newton(const ArrayType & z, Matrix<T, 3, 1> guess)
+		{
+			// Square sum error at each step
+			T prev_sqsum = std::numeric_limits<T>::max();
+			T this_sqsum = std::numeric_limits<T>::max();
+
+			std::size_t start = _iterations;
+			bool first = true;
+			while (true) {
+				// Stop condition:  Check total error
+				prev_sqsum = this_sqsum;
+				this_sqsum = evaluate(z, guess);
+				_final_sqsum = this_sqsum;
+				if (first)
+					_initial_sqsum = this_sqsum;
+				first = false;
 
-					// Collect potential data at (x,y)
-					Matrix<T, Dynamic, 1> pvec {potential.size_2(), 1};
-					for (std::size_t k=0; k < potential.size_2(); k++) {
-						pvec(k) = potential(i,j,k);
+				if (!std::isfinite(this_sqsum)) {
+					_status = LJFitStatus::Diverged;
+					break;
+				}
+
+				if (!std::isnormal(this_sqsum)) {
+					_status = LJFitStatus::Exact;
+					break;	// our answer is perfect. Bail out before we divide by zero >_>
+				}
+
+				if (converged(fabs(this_sqsum - prev_sqsum), this_sqsum)) {
+					_status = LJFitStatus::Converged;
+					break;  // Natural stopping condition (error has converged)
+				}
+
+				if (_iterations - start >= options.max_iterations()) {
+					_status = LJFitStatus::IterationLimit;
+					break;
+				}
+
+				// Refine guess by solving the least squares system
+				differentiate(guess);
+				guess += solve_least_squares(n);
+				_iterations++;
+			}
+
+			return guess;
+		}
+
+		// Each step solves the least squares system with the rows sqrt(lambda) D appended,
+		//  where D holds the norms of the jacobian's columns (which makes the damping
+		//  independent of the parameters' very different scales).
+		// The damping is updated as in Nielsen (1999): steps that would raise the error are
+		//  retried with ever more damping, and accepted ones relax it according to how well
+		//  the linearization predicted the error they actually achieved.  (Simply cutting it
+		//  by a fixed factor after each success tends to zigzag, with every other step
+		//  rejected, through the long curved valleys these fits have.)
+		Matrix<T, 3, 1> levenberg_marquardt(const ArrayType & z, Matrix<T, 3, 1> guess)
+		{
+			T lambda = 1E-3;
+			T growth = 2;
+			T sqsum = evaluate(z, guess);
+			_initial_sqsum = sqsum;
+			_final_sqsum = sqsum;
+
+			std::size_t start = _iterations;
+			while (true) {
+				// (the error only grows from the starting point, so a bad one means a bad seed)
+				if (!std::isfinite(sqsum)) {
+					_status = LJFitStatus::Diverged;
+					break;
+				}
+
+				if (!std::isnormal(sqsum)) {
+					_status = LJFitStatus::Exact;
+					break;
+				}
+
+				differentiate(guess);
+				base_jacobian = jacobian.topRows(n);
+				base_errors = errors.head(n);
+				Matrix<T, 1, 3> scale = base_jacobian.colwise().norm();
+
+				bool accepted = false;
+				bool out_of_iterations = false;
+				T trial_sqsum = sqsum;
+				for (int rejections=0; rejections < MAX_REJECTIONS; rejections++) {
+					if (_iterations - start >= options.max_iterations()) {
+						out_of_iterations = true;
+						break;
+					}
+
+					jacobian.topRows(n) = base_jacobian;
+					jacobian.bottomRows(3).setZero();
+					jacobian.bottomRows(3).diagonal() = std::sqrt(lambda) * scale.transpose();
+					errors.head(n) = base_errors;
+					errors.tail(3).setZero();
+
+					Matrix<T, 3, 1> step = solve_least_squares(n + 3);
+					Matrix<T, 3, 1> trial = guess + step;
+					_iterations++;
+
+					// reduction in the error that the linearized model predicts
+					rhs.head(n).noalias() = base_errors - base_jacobian * step;
+					T predicted = sqsum - rhs.head(n).squaredNorm();
+
+					trial_sqsum = evaluate(z, trial);
+					if (trial_sqsum < sqsum) {
+						T gain = (sqsum - trial_sqsum) / predicted;
+						T shrink = (predicted > 0)? 1 - ipow<3>(2 * gain - 1) : T(1) / 3;
+						lambda *= std::max(T(1) / 3, shrink);
+						growth = 2;
+						guess = trial;
+						accepted = true;
+						break;
 					}
+					lambda *= growth;
+					growth *= 2;
+				}
 
-					// FIXME: a third parameter is needed (the z=0 point)
+				if (!accepted) {
+					_status = out_of_iterations? LJFitStatus::IterationLimit : LJFitStatus::Stalled;
+					break;
+				}
+
+				T change = sqsum - trial_sqsum;
+				sqsum = trial_sqsum;
+				_final_sqsum = sqsum;
+				if (converged(change, sqsum)) {
+					_status = LJFitStatus::Converged;
+					break;
+				}
+			}
 
-					// Solve the least squares system
-					Matrix<T, 2, 1> soln = solver.solve(pvec);
+			return guess;
+		}
+
+		// The least squares solution to (the first `rows` rows of) jacobian * x = errors, by
+		//  Householder QR with column pivoting, like Eigen's ColPivHouseholderQR.  (which
+		//  allocates temporaries inside compute() and solve() no matter how it was
+		//  constructed, so with only three columns it is simplest to factor in place here)
+		// Destroys the jacobian.
+		Matrix<T, 3, 1> solve_least_squares(Index rows)
+		{
+			auto a = jacobian.topRows(rows); // becomes R above the diagonal, reflectors below
+			Index diag = std::min<Index>(rows, 3);
+			Index perm[3] = {0, 1, 2};
+			rhs.head(rows) = errors.head(rows);
 
-					// Record
-					result.z0(i,j)      = 0; // FIXME compute this proper
-					result.coeff6(i,j)  = soln(0,0);
-					result.coeff12(i,j) = soln(1,0); 
+			for (Index k=0; k < diag; k++) {
+				// pivot on the remaining column with the largest norm
+				Index best = k;
+				T best_norm = a.col(k).tail(rows - k).squaredNorm();
+				for (Index j=k+1; j < 3; j++) {
+					T norm = a.col(j).tail(rows - k).squaredNorm();
+					if (norm > best_norm) {
+						best = j;
+						best_norm = norm;
+					}
 				}
+				if (best != k) {
+					a.col(k).swap(a.col(best));
+					std::swap(perm[k], perm[best]);
+				}
+				if (best_norm == 0)
+					break;
+
+				// reflector I - tau v v^T (with v(k) = 1) taking column k to (beta, 0, ..., 0)
+				T alpha = a(k, k);
+				T beta = (alpha >= 0)? -std::sqrt(best_norm) : std::sqrt(best_norm);
+				T tau = (beta - alpha) / beta;
+				a.col(k).tail(rows - k - 1) /= (alpha - beta);
+				a(k, k) = beta;
+
+				for (Index j=k+1; j < 3; j++)
+					reflect(a.col(j), rows, k, tau);
+				reflect(rhs, rows, k, tau);
 			}
 
+			// columns whose pivots are negligible next to the first are left out of the solution
+			T threshold = std::fabs(a(0, 0)) * std::numeric_limits<T>::epsilon() * T(diag);
+			Index rank = 0;
+			while (rank < diag && std::fabs(a(rank, rank)) > threshold)
+				rank++;
+
+			// back substitution with R
+			Matrix<T, 3, 1> c = Matrix<T, 3, 1>::Zero();
+			for (Index i=rank-1; i >= 0; i--) {
+				T sum = rhs(i);
+				for (Index j=i+1; j < rank; j++)
+					sum -= a(i, j) * c(j);
+				c(i) = sum / a(i, i);
+			}
+
+			Matrix<T, 3, 1> result;
+			for (Index i=0; i < 3; i++)
+				result(perm[i]) = c(i);
 			return result;
 		}
 
-		#else // #ifdef PP_LINEAR
+		// y -= tau v (v . y), for the reflector stored below the diagonal in column k of the
+		//  jacobian (over its first `rows` rows)
+		template <class Vec>
+		void reflect(Vec && y, Index rows, Index k, T tau) const
+		{
+			Index below = rows - k - 1;
+			T w = y(k) + jacobian.col(k).segment(k + 1, below).dot(y.segment(k + 1, below));
+			y(k) -= tau * w;
+			y.segment(k + 1, below) -= (tau * w) * jacobian.col(k).segment(k + 1, below);
+		}
+};
 
-		static LJPseudoPotential fit_to_data(Lattice3<T> potential, T tolerance=1E-9)
+template <class T> const int LJFitWorkspace<T>::MAX_REJECTIONS;
+
+// The file format of LJPseudoPotential::save() and open_mapped(), which is just the
+//  object's memory layout: this header, and then, from records_offset (a multiple of 64),
+//  the record of every point, row by row, exactly as record() returns them.  Nothing is
+//  parsed when a file is opened; the records are used in place, from the mapped pages.
+// Values are in the writer's byte order (byte_order tells whether it matches the reader's).
+const std::uint32_t LJ_FILE_VERSION = 1;
+const std::uint32_t LJ_FILE_BYTE_ORDER = 0x01020304;
+
+struct LJPseudoPotentialFileHeader {
+	char          magic[8];        // "LJPSEUDO"
+	std::uint32_t version;         // LJ_FILE_VERSION
+	std::uint32_t byte_order;      // LJ_FILE_BYTE_ORDER
+	std::uint32_t scalar_size;     // sizeof(T)
+	std::uint32_t interpolation;   // 0 = Nearest, 1 = Bicubic (which sets the record size)
+	std::uint64_t dims[2];
+	std::uint64_t record_size;     // values per record
+	std::uint64_t records_offset;  // bytes from the start of the file
+	double        lower[2];        // coordinates of the first and last points along each axis
+	double        upper[2];
+};
+
+// Thrown on reading a file that is not a pseudopotential this build can use
+struct LJPseudoPotentialFileError : public std::runtime_error {
+	template <class... Args>
+	LJPseudoPotentialFileError(Args&&... args)
+	: std::runtime_error(std::forward<Args>(args)...)
+	{ }
+};
+
+// The fitted parameters are stored as one record per (x,y) point of the fit, each holding
+//  the point's (z0, c6, c12) together with the bicubic patch of the cell it is the lower
+//  corner of, so that a lookup reads one contiguous, cache line aligned block rather than
+//  a line from each of several arrays.
+//
+// The records can also live in a file mapped into memory (see open_mapped()), shared with
+//  every other process using the same file.
+//
+// A record is a sequence of terms of RECORD_LANES values: the coefficients of one power
+//  u^p v^q (term 4p + q) for z0, c6 and c12, then one value of padding.  The constant term
+//  comes first, and holds the fitted values themselves.  Without interpolation only that
+//  term is stored.
+//
+// For T = double a bicubic record is 16 terms of 32 bytes (512 bytes, or eight cache
+//  lines), and a record without interpolation is a single term.  The padding is a quarter
+//  of that, and is never read; it keeps each term a whole, aligned group of four, which
+//  the lane loops compile to whole vector operations on, and keeps a lone term from ever
+//  straddling a cache line.  (Packing the terms into three lanes made bicubic lookups
+//  about 30% slower.)
+template <class T>
+class LJPseudoPotential {
+	public:
+		static const std::size_t RECORD_LANES = 4;
+		static const std::size_t PATCH_TERMS = 16;
+
+		// d1 x d2 points spanning [0,1] along each axis, with all parameters 0.
+		// Each axis needs at least 2 points (for its step, and the patches between them).
+		LJPseudoPotential(std::size_t d1, std::size_t d2)
+		: _dims{{check_size(d1), check_size(d2)}}
+		, _lower{{0, 0}}
+		, _upper{{1, 1}}
+		, _step{{T(1) / (d1 - 1), T(1) / (d2 - 1)}}
+		, records(d1 * d2 * record_size(), T(0))
+		{ }
+
+
+		// Fits (z0, c6, c12) to each (x,y) column of the potential, as set out in `options`
+		//  (see LJFitMethod and LJFitSeeding).
+		// Columns are shared out among threads a row at a time, as threads become free, since
+		//  the number of iterations needed to converge varies a lot from column to column.
+		//  The result does not depend on the thread count.  (Continuation always runs on a
+		//  single thread, and Linear is a single matrix product)
+		// How each column's fit went is recorded in `diagnostics`, which is reshaped to match.
+		static LJPseudoPotential fit_to_data(Lattice3<T> potential, const LJFitOptions<T> & options,
+		                                     LJFitDiagnostics<T> & diagnostics)
 		{
 			LJPseudoPotential result {potential.size_0(), potential.size_1()};
 
-			// make coeff lattices in the shape of the x & y dimensions of potential
-			result.z0      = make_sub_lattice<T>(potential, 0, 1);
-			result.coeff6  = make_sub_lattice<T>(potential, 0, 1);
-			result.coeff12 = make_sub_lattice<T>(potential, 0, 1);
-
-			// Declare our main matrices & reserve memory
-			Array<T,  Dynamic, 1> zarr     {potential.size_2(), 1};
-			Array<T,  Dynamic, 1> varr     {potential.size_2(), 1};
-			Matrix<T, Dynamic, 1> errors   {potential.size_2(), 1};
-			Matrix<T, Dynamic, 3> jacobian {potential.size_2(), 3};
+			// coefficients in the shape of the x & y dimensions of potential
+			Lattice2<T> shape = make_sub_lattice<T>(potential, 0, 1);
+			result._lower = {{shape.lower_coord_0(), shape.lower_coord_1()}};
+			result._upper = {{shape.upper_coord_0(), shape.upper_coord_1()}};
+			for (int axis=0; axis<2; axis++)
+				result._step[axis] = (result._upper[axis] - result._lower[axis]) / (result._dims[axis] - 1);
+			diagnostics = LJFitDiagnostics<T>(shape);
 
 			// Collect z data (our independent variable)
+			Array<T, Dynamic, 1> zarr {potential.size_2(), 1};
 			for (std::size_t k=0; k < potential.size_2(); k++)
 				zarr(k) = potential.coord_2(k);
 
-			// Square sum error at each step
-			T prev_sqsum = std::numeric_limits<T>::max();
-			T this_sqsum = std::numeric_limits<T>::max();
+			switch (options.method()) {
+			case LJFitMethod::Linear:
+				fit_linear(potential, zarr, result, diagnostics);
+				break;
 
-			// Solve for a best fit along z at each (x,y)
-			for (std::size_t i=0; i < potential.size_0(); i++) {
-				for (std::size_t j=0; j < potential.size_1(); j++) {
+			case LJFitMethod::GaussNewton:
+			case LJFitMethod::LevenbergMarquardt:
+				fit_nonlinear(potential, zarr, options, result, diagnostics);
+				break;
 
-					// Collect potential data (our dependent variable) at (x,y)
-					for (std::size_t k=0; k < potential.size_2(); k++)
-						varr(k) = potential(i,j,k);
+			case LJFitMethod::Hybrid:
+				// the linear solution, recorded first, is each column's seed
+				fit_linear(potential, zarr, result, diagnostics);
+				fit_nonlinear(potential, zarr, options, result, diagnostics);
+				break;
+			}
 
-					// Form initial guess, and unpack it into more meaningfully named vars
-					Matrix<T, 3, 1> guess;
-					T & guess_z0  = guess(0,0);
-					T & guess_c6  = guess(1,0);
-					T & guess_c12 = guess(2,0);
+			result.build_patches();
+			return result;
+		}
 
-					// TODO fixed guess = nnnnooooooope
-					guess_z0  = 0.05;
-					guess_c6  = -1.;
-					guess_c12 = +1.;
+		static LJPseudoPotential fit_to_data(Lattice3<T> potential, const LJFitOptions<T> & options)
+		{
+			LJFitDiagnostics<T> diagnostics;
+			return fit_to_data(potential, options, diagnostics);
+		}
 
-					while (true) {
-						// z - z0
-						Array<T, Dynamic, 1> delta_z = zarr - guess_z0;
+		// fit_to_data with the default method (GaussNewton)
+		static LJPseudoPotential fit_to_data(Lattice3<T> potential, T tolerance=1E-9, unsigned threads=0,
+		                                     LJFitSeeding seeding=LJFitSeeding::Fixed)
+		{
+			return fit_to_data(potential, LJFitOptions<T>()
+				.set_tolerance(tolerance)
+				.set_threads(threads)
+				.set_seeding(seeding)
+			);
+		}
 
-						// Differences between potential data and potential computed from guess
-						errors = varr - guess_c6 * delta_z.pow(-6) - guess_c12 * delta_z.pow(-12);
 
+		// Named parameter idiom for the less significant details
+		// (Switching to Nearest drops the patches; switching back rebuilds them.  Either way
+		//  the records are rebuilt in memory, and a mapped file is let go.)
+		LJPseudoPotential & set_interpolation(LJInterpolation interpolation) {
+			if (interpolation != _interpolation) {
+				LJPseudoPotential old = *this;
+				_interpolation = interpolation;
+				_mapping.reset();
+				_mapped_records = nullptr;
+				records.assign(size_0() * size_1() * record_size(), T(0));
+				for (std::size_t i=0; i < size_0(); i++)
+					for (std::size_t j=0; j < size_1(); j++)
+						set_parameters(i, j, old.z0(i,j), old.coeff6(i,j), old.coeff12(i,j));
+				build_patches();
+			}
+			return *this;
+		}
 
-						// TODO: I think there needs to be more freedom with the stop condition.
-						//       Or *less* freedom. >_>
+		LJInterpolation interpolation() const { return _interpolation; }
 
-						// Stop condition:  Check total error
-						prev_sqsum = this_sqsum;
-						this_sqsum = errors.squaredNorm();
+		// The fitted parameters at each (x,y) point of the fit (views into the records)
+		T z0      (std::size_t i, std::size_t j) const { return record(i, j)[0]; }
+		T coeff6  (std::size_t i, std::size_t j) const { return record(i, j)[1]; }
+		T coeff12 (std::size_t i, std::size_t j) const { return record(i, j)[2]; }
 
-						if (!std::isnormal(prev_sqsum)) {
-							assert(!std::isinf(prev_sqsum) && !std::isnan(prev_sqsum));
-							break;	// our answer is perfect. Bail out before we divide by zero >_>
-						}
+		std::size_t size_0 () const { return _dims[0]; }
+		std::size_t size_1 () const { return _dims[1]; }
+		T coord_0 (std::size_t i) const { return _lower[0] + i * coord_step(0); }
+		T coord_1 (std::size_t j) const { return _lower[1] + j * coord_step(1); }
 
-						if (fabs(this_sqsum - prev_sqsum) < tolerance)
-							break;  // Natural stopping condition (error has converged)
+		// The record of point (i,j), of record_size() values, aligned to a cache line when
+		//  it is at least one long (and otherwise never straddling one)
+		const T * record (std::size_t i, std::size_t j) const { return record_data() + (i * size_1() + j) * record_size(); }
+		std::size_t record_size () const {
+			return RECORD_LANES * ((_interpolation == LJInterpolation::Bicubic)? PATCH_TERMS : 1);
+		}
 
+		// Writes the records to `path` in the format of LJPseudoPotentialFileHeader, to be
+		//  read back by open_mapped().
+		void save(const std::string & path) const
+		{
+			LJPseudoPotentialFileHeader header;
+			std::memset(&header, 0, sizeof header);
+			std::memcpy(header.magic, "LJPSEUDO", sizeof header.magic);
+			header.version = LJ_FILE_VERSION;
+			header.byte_order = LJ_FILE_BYTE_ORDER;
+			header.scalar_size = sizeof(T);
+			header.interpolation = (_interpolation == LJInterpolation::Bicubic)? 1 : 0;
+			header.record_size = record_size();
+			header.records_offset = FILE_ALIGNMENT * ((sizeof header + FILE_ALIGNMENT - 1) / FILE_ALIGNMENT);
+			for (int axis=0; axis<2; axis++) {
+				header.dims[axis] = _dims[axis];
+				header.lower[axis] = _lower[axis];
+				header.upper[axis] = _upper[axis];
+			}
 
-						// Derivatives of the potential with respect to each fit parameter
-						jacobian.col(0) = 6. * guess_c6 * delta_z.pow(-7) + 12. * guess_c12 * delta_z.pow(-13);
-						jacobian.col(1) = delta_z.pow(-6);
-						jacobian.col(2) = delta_z.pow(-12);
+			std::ofstream out(path, std::ios::binary | std::ios::trunc);
+			std::vector<char> padding(header.records_offset - sizeof header, 0);
+			out.write(reinterpret_cast<const char *>(&header), sizeof header);
+			out.write(padding.data(), padding.size());
+			out.write(reinterpret_cast<const char *>(record_data()), size_0() * size_1() * record_size() * sizeof(T));
+			out.close();
+			if (!out)
+				throw LJPseudoPotentialFileError(path + ": could not be written");
+		}
 
-						// Refine guess by solving the normal equation
-						guess += jacobian.colPivHouseholderQr().solve(errors);
-					}
+		// The pseudopotential saved in `path`, which is mapped into memory and used as it is.
+		// (copies share the mapping, which lasts as long as any of them)
+		static LJPseudoPotential open_mapped(const std::string & path)
+		{
+			auto file = std::make_shared<const MappedFile>(path);
+			auto fail = [&] (const std::string & why) { return LJPseudoPotentialFileError(path + ": " + why); };
 
-					// Record
-					result.z0(i,j)      = guess_z0;
-					result.coeff6(i,j)  = guess_c6;
-					result.coeff12(i,j) = guess_c12;
-				}
-			}
+			LJPseudoPotentialFileHeader header;
+			if (file->size() < sizeof header || std::memcmp(file->data(), "LJPSEUDO", sizeof header.magic) != 0)
+				throw fail("not a pseudopotential file");
+			std::memcpy(&header, file->data(), sizeof header);
 
+			if (header.byte_order != LJ_FILE_BYTE_ORDER)
+				throw fail("written with a different byte order");
+			if (header.version != LJ_FILE_VERSION)
+				throw fail("unsupported version " + std::to_string(header.version));
+			if (header.scalar_size != sizeof(T))
+				throw fail("holds " + std::to_string(header.scalar_size) + "-byte values, not " + std::to_string(sizeof(T)));
+			if (header.interpolation > 1)
+				throw fail("unknown interpolation");
+			if (header.dims[0] < 2 || header.dims[1] < 2)
+				throw fail("fewer than 2 points along an axis");
+
+			LJPseudoPotential result;
+			result._interpolation = (header.interpolation == 1)? LJInterpolation::Bicubic : LJInterpolation::Nearest;
+			if (header.record_size != result.record_size())
+				throw fail("record size does not match its interpolation");
+			if (header.records_offset % FILE_ALIGNMENT != 0 || header.records_offset < sizeof header)
+				throw fail("misplaced records");
+
+			std::uint64_t bytes = header.dims[0] * header.dims[1] * header.record_size * sizeof(T);
+			if (bytes / header.dims[1] / header.record_size / sizeof(T) != header.dims[0])
+				throw fail("implausible dimensions");
+			if (file->size() < header.records_offset || file->size() - header.records_offset < bytes)
+				throw fail("truncated");
+
+			for (int axis=0; axis<2; axis++) {
+				result._dims[axis] = header.dims[axis];
+				result._lower[axis] = header.lower[axis];
+				result._upper[axis] = header.upper[axis];
+				result._step[axis] = (result._upper[axis] - result._lower[axis]) / (result._dims[axis] - 1);
+			}
+			result._mapped_records = reinterpret_cast<const T *>(file->data() + header.records_offset);
+			result._mapping = file;
 			return result;
 		}
-		#endif
 
+		// Whether the records are read from a mapped file
+		bool is_mapped() const { return bool(_mapping); }
 
+		// Points off the fit's (x,y) lattice take the parameters of its nearest edge.
 		T value_at(T x, T y, T z) {
-			// do nearest neighbor for x and y <---- HORRIBLE IDEA  FIXME FIXME FIXME
-			int i = nearest_index_x(x);
-			int j = nearest_index_y(y);
-			T r   = z - z0(i,j);
-			T c6  = coeff6(i,j);
-			T c12 = coeff12(i,j);
-
-			return c6 * pow(r,-6) + c12 * pow(r,-12);
+			T p_z0, c6, c12;
+			parameters_at(x, y, p_z0, c6, c12);
+			return lj_value(z - p_z0, c6, c12);
 		}
 
 		T force_z_derivative_at(T x, T y, T z) {
-			// do nearest neighbor for x and y <---- HORRIBLE IDEA  FIXME FIXME FIXME
-			int i = nearest_index_x(x);
-			int j = nearest_index_y(y);
-			T r   = z - z0(i,j);
-			T c6  = coeff6(i,j);
-			T c12 = coeff12(i,j);
+			T p_z0, c6, c12;
+			parameters_at(x, y, p_z0, c6, c12);
+			T r = z - p_z0;
 
 			// expression obtained by le maths
 			T result = 0;
-			result += (36*4*26*27) * pow(r, -28) * c12 * c12;
-			result += (36*4*20*21) * pow(r, -22) * c12 * c6;
-			result += (36*1*14*15) * pow(r, -15) * c6  * c6;
+			result += (36*4*26*27) * ipow<-28>(r) * c12 * c12;
+			result += (36*4*20*21) * ipow<-22>(r) * c12 * c6;
+			result += (36*1*14*15) * ipow<-15>(r) * c6  * c6;
 
 			// TODO: This final expression should multiplied by some scalar constant related to
 			//       polarization of the tip. Not sure what determines this constant, not sure
@@ -194,17 +749,426 @@ class LJPseudoPotential {
 			return result;
 		}
 
+		// Fills `out` with value_at(x, y, z) at each of its points, bitwise.
+		// Far cheaper than calling value_at per pixel: each row's parameters are found in
+		//  one pass along it (collapsing a cell's patches once for all of the pixels that
+		//  fall in it), and the potential is then taken a SIMD vector at a time, with a
+		//  single division per pixel.  Rows are shared out among `threads` threads (0 = one
+		//  per hardware thread).
+		void render_plane(T z, Lattice2<T> & out, unsigned threads=0) const
+		{
+			std::size_t n1 = out.size_1();
+			if (n1 == 0)
+				return;
+
+			std::vector<T> ys(n1);
+			for (std::size_t j=0; j < n1; j++)
+				ys[j] = out.coord_1(j);
+
+			parallel_for_with_state(out.size_0(), threads,
+				[&] () { return RenderRow(n1); },
+				[&] (RenderRow & row, std::size_t i) {
+					row_parameters(out.coord_0(i), ys, row);
+					render_row(z, row, &out(i, std::size_t(0)));
+				}
+			);
+		}
+
+		// render_plane for every height of `out` at once, where each column's parameters are
+		//  found only once.
+		void render_volume(Lattice3<T> & out, unsigned threads=0) const
+		{
+			std::size_t n1 = out.size_1(), n2 = out.size_2();
+			if (n1 == 0 || n2 == 0)
+				return;
+
+			std::vector<T> ys(n1), zs(n2);
+			for (std::size_t j=0; j < n1; j++)
+				ys[j] = out.coord_1(j);
+			for (std::size_t k=0; k < n2; k++)
+				zs[k] = out.coord_2(k);
+
+			parallel_for_with_state(out.size_0(), threads,
+				[&] () { return RenderRow(n1); },
+				[&] (RenderRow & row, std::size_t i) {
+					row_parameters(out.coord_0(i), ys, row);
+					for (std::size_t j=0; j < n1; j++)
+						render_column(zs, row.z0[j], row.c6[j], row.c12[j], &out(i, j, std::size_t(0)));
+				}
+			);
+		}
+
 	private:
+		// c6 and c12 of every column by linear least squares, with z0 = 0
+		static void fit_linear(const Lattice3<T> & potential, const Array<T, Dynamic, 1> & zarr,
+		                       LJPseudoPotential & result, LJFitDiagnostics<T> & diagnostics)
+		{
+			// Generate coefficient matrix
+			Array<T, Dynamic, 1> zinv6 = zarr.inverse().cube().square();
+			Matrix<T, Dynamic, 2> xmat {potential.size_2(), 2};
+			xmat.col(0) = zinv6;
+			xmat.col(1) = zinv6.square();
+
+			// Every column shares the same least squares system, so its pseudo-inverse is
+			//  computed once, and then all of the columns are solved at once by one matrix
+			//  product (which Eigen blocks for the cache) rather than one solve() apiece.
+			Matrix<T, 2, Dynamic> pinv = xmat.colPivHouseholderQr().solve(
+				Matrix<T, Dynamic, Dynamic>::Identity(potential.size_2(), potential.size_2())
+			);
+
+			// Collect potential data, one (x,y) column per matrix column
+			std::size_t ncols = potential.size_0() * potential.size_1();
+			Matrix<T, Dynamic, Dynamic> pmat {potential.size_2(), ncols};
+			for (std::size_t i=0; i < potential.size_0(); i++)
+				for (std::size_t j=0; j < potential.size_1(); j++)
+					for (std::size_t k=0; k < potential.size_2(); k++)
+						pmat(k, i*potential.size_1() + j) = potential(i,j,k);
+
+			// FIXME: a third parameter is needed (the z=0 point)
+
+			// Solve the least squares systems
+			Matrix<T, 2, Dynamic> soln {2, ncols};
+			soln.noalias() = pinv * pmat;
+
+			// (and what is left over, for the diagnostics)
+			pmat.noalias() -= xmat * soln;
+
+			// Record
+			for (std::size_t i=0; i < potential.size_0(); i++) {
+				for (std::size_t j=0; j < potential.size_1(); j++) {
+					// FIXME compute z0 proper
+					result.set_parameters(i, j, 0, soln(0, i*potential.size_1() + j), soln(1, i*potential.size_1() + j));
+
+					diagnostics.iterations(i,j) = 0;
+					diagnostics.residual(i,j)   = pmat.col(i*potential.size_1() + j).squaredNorm();
+					diagnostics.set_status(i, j, LJFitStatus::Direct);
+				}
+			}
+		}
+
+		// (z0, c6, c12) of every column by Gauss-Newton or Levenberg-Marquardt.
+		// For Hybrid, each column starts from what `result` already holds for it.
+		static void fit_nonlinear(const Lattice3<T> & potential, const Array<T, Dynamic, 1> & zarr,
+		                          const LJFitOptions<T> & options, LJPseudoPotential & result,
+		                          LJFitDiagnostics<T> & diagnostics)
+		{
+			unsigned threads = options.threads();
+
+			auto make_workspace = [&] () { return LJFitWorkspace<T>(potential.size_2(), options); };
+
+			// Collect potential data (our dependent variable) at (x,y)
+			auto load_column = [&] (LJFitWorkspace<T> & workspace, std::size_t i, std::size_t j) {
+				for (std::size_t k=0; k < potential.size_2(); k++)
+					workspace.values(k) = potential(i,j,k);
+			};
+
+			// Record the last fit made with the workspace
+			auto record = [&] (std::size_t i, std::size_t j, const LJFitWorkspace<T> & workspace, const Matrix<T, 3, 1> & fit) {
+				result.set_parameters(i, j, fit(0,0), fit(1,0), fit(2,0));
+
+				diagnostics.iterations(i,j) = T(workspace.iterations());
+				diagnostics.residual(i,j)   = workspace.residual();
+				diagnostics.set_status(i, j, workspace.status());
+			};
+
+			auto recorded = [&] (std::size_t i, std::size_t j) {
+				return Matrix<T, 3, 1>(result.z0(i,j), result.coeff6(i,j), result.coeff12(i,j));
+			};
+
+			LJFitSeeding seeding = options.seeding();
+			if (options.method() == LJFitMethod::Hybrid)
+				seeding = LJFitSeeding::Fixed;
+
+			// Solve for a best fit along z at each (x,y)
+			switch (seeding) {
+			case LJFitSeeding::Fixed:
+				parallel_for_with_state(potential.size_0(), threads, make_workspace, [&] (LJFitWorkspace<T> & workspace, std::size_t i) {
+					for (std::size_t j=0; j < potential.size_1(); j++) {
+						load_column(workspace, i, j);
+						if (options.method() == LJFitMethod::Hybrid)
+							record(i, j, workspace, workspace.fit(zarr, recorded(i, j)));
+						else
+							record(i, j, workspace, workspace.fit(zarr));
+					}
+				});
+				break;
+
+			case LJFitSeeding::Continuation: {
+				LJFitWorkspace<T> workspace = make_workspace();
+				Matrix<T, 3, 1> fit = LJFitWorkspace<T>::default_guess();
+				for (std::size_t i=0; i < potential.size_0(); i++) {
+					for (std::size_t n=0; n < potential.size_1(); n++) {
+						std::size_t j = (i % 2 == 0)? n : potential.size_1() - 1 - n;
+						load_column(workspace, i, j);
+						fit = workspace.fit(zarr, fit);
+						record(i, j, workspace, fit);
+					}
+				}
+				break;
+			}
+
+			case LJFitSeeding::Coarse: {
+				const std::size_t stride = COARSE_FIT_STRIDE;
+				std::size_t coarse_0 = (potential.size_0() + stride - 1) / stride;
+				std::size_t coarse_1 = (potential.size_1() + stride - 1) / stride;
+
+				// pre-fit of every stride-th column, which goes straight into the result
+				std::vector<Matrix<T, 3, 1>> coarse(coarse_0 * coarse_1);
+				parallel_for_with_state(coarse_0, threads, make_workspace, [&] (LJFitWorkspace<T> & workspace, std::size_t a) {
+					for (std::size_t b=0; b < coarse_1; b++) {
+						load_column(workspace, a*stride, b*stride);
+						coarse[a*coarse_1 + b] = workspace.fit(zarr);
+						record(a*stride, b*stride, workspace, coarse[a*coarse_1 + b]);
+					}
+				});
+
+				// the rest, from the nearest coarse column
+				parallel_for_with_state(potential.size_0(), threads, make_workspace, [&] (LJFitWorkspace<T> & workspace, std::size_t i) {
+					std::size_t a = std::min((i + stride/2) / stride, coarse_0 - 1);
+					for (std::size_t j=0; j < potential.size_1(); j++) {
+						if (i % stride == 0 && j % stride == 0)
+							continue;
+
+						std::size_t b = std::min((j + stride/2) / stride, coarse_1 - 1);
+						load_column(workspace, i, j);
+						record(i, j, workspace, workspace.fit(zarr, coarse[a*coarse_1 + b]));
+					}
+				});
+				break;
+			}
+			}
+		}
+
+		// (for open_mapped, which fills in everything)
+		LJPseudoPotential() { }
+
+		static std::size_t check_size (std::size_t size) {
+			if (size < 2)
+				throw std::invalid_argument("LJPseudoPotential: need at least 2 points along each axis");
+			return size;
+		}
+
+		// Records start on a cache line in memory, and at a multiple of this in files (so
+		//  that they are just as aligned when mapped)
+		static const std::size_t FILE_ALIGNMENT = 64;
+
+		const T * record_data () const { return _mapped_records? _mapped_records : records.data(); }
+
+		// (only for records in memory)
+		T * writable_record (std::size_t i, std::size_t j) { return &records[(i * size_1() + j) * record_size()]; }
+
+		void set_parameters (std::size_t i, std::size_t j, T p_z0, T c6, T c12) {
+			T * r = writable_record(i, j);
+			r[0] = p_z0;
+			r[1] = c6;
+			r[2] = c12;
+		}
+
+		T coord_step (int axis) const { return _step[axis]; }
+
 		// returns lattice indices of nearest point on lattice
-		int nearest_index_x (T x) {
-			return int((x - coeff6.lower_coord_0())/coeff6.coord_step_0() + 0.5);
+		std::size_t nearest_index_x (T x) const {
+			return nearest_index(x, _lower[0], coord_step(0), size_0());
+		}
+		std::size_t nearest_index_y (T y) const {
+			return nearest_index(y, _lower[1], coord_step(1), size_1());
+		}
+
+		static std::size_t nearest_index (T x, T lower, T step, std::size_t size) {
+			T t = (x - lower)/step + 0.5;
+			return (t > 0)? std::min(std::size_t(t), size - 1) : 0;
+		}
+
+		// Whether lookups go through the patches (which need at least 2 points along each axis)
+		bool interpolating () const {
+			return _interpolation == LJInterpolation::Bicubic && size_0() >= 2 && size_1() >= 2;
+		}
+
+		// (z0, c6, c12) at (x,y)
+		void parameters_at (T x, T y, T & p_z0, T & c6, T & c12) const {
+			if (!interpolating()) {
+				const T * r = record(nearest_index_x(x), nearest_index_y(y));
+				p_z0 = r[0];
+				c6   = r[1];
+				c12  = r[2];
+				return;
+			}
+
+			std::size_t i, j;
+			T u, v;
+			locate(x, _lower[0], coord_step(0), size_0(), i, u);
+			locate(y, _lower[1], coord_step(1), size_1(), j, v);
+
+			T b[4 * RECORD_LANES];
+			collapse_patch(record(i, j), u, b);
+			evaluate_collapsed(b, v, p_z0, c6, c12);
+		}
+
+		// The three patches of a record taken at u, which leaves a cubic in v for each:
+		//  b[RECORD_LANES*q + l] = sum of a[4p + q] u^p, for lane l
+		static void collapse_patch (const T * a, T u, T * b) {
+			for (int q=0; q < 4; q++) {
+				T * bq = b + RECORD_LANES*q;
+				for (std::size_t l=0; l < RECORD_LANES; l++)
+					bq[l] = a[RECORD_LANES*(4*3 + q) + l];
+				for (int p=2; p >= 0; p--)
+					for (std::size_t l=0; l < RECORD_LANES; l++)
+						bq[l] = bq[l] * u + a[RECORD_LANES*(4*p + q) + l];
+			}
 		}
-		int nearest_index_y (T y) {
-			return int((y - coeff6.lower_coord_1())/coeff6.coord_step_1() + 0.5);
+
+		static void evaluate_collapsed (const T * b, T v, T & p_z0, T & c6, T & c12) {
+			T result[RECORD_LANES];
+			for (std::size_t l=0; l < RECORD_LANES; l++)
+				result[l] = b[RECORD_LANES*3 + l];
+			for (int q=2; q >= 0; q--)
+				for (std::size_t l=0; l < RECORD_LANES; l++)
+					result[l] = result[l] * v + b[RECORD_LANES*q + l];
+			p_z0 = result[0];
+			c6   = result[1];
+			c12  = result[2];
 		}
 
-		Lattice2<T> z0;
-		Lattice2<T> coeff6;
-		Lattice2<T> coeff12;
+		// c6 r^-6 + c12 r^-12, for a scalar or a SIMD vector (see util/simd.hpp)
+		template <class V>
+		static V lj_value (V r, V c6, V c12) {
+			V inv6 = V(T(1)) / ipow<6>(r);
+			return c6 * inv6 + c12 * (inv6 * inv6);
+		}
+
+		// Parameters of each pixel of a row being rendered
+		struct RenderRow {
+			explicit RenderRow (std::size_t n) : z0(n), c6(n), c12(n) { }
+			std::vector<T> z0, c6, c12;
+		};
+
+		// parameters_at(x, ys[j]) for each j, into row
+		void row_parameters (T x, const std::vector<T> & ys, RenderRow & row) const {
+			if (!interpolating()) {
+				std::size_t i = nearest_index_x(x);
+				for (std::size_t j=0; j < ys.size(); j++) {
+					const T * r = record(i, nearest_index_y(ys[j]));
+					row.z0[j]  = r[0];
+					row.c6[j]  = r[1];
+					row.c12[j] = r[2];
+				}
+				return;
+			}
+
+			std::size_t i;
+			T u;
+			locate(x, _lower[0], coord_step(0), size_0(), i, u);
+
+			T b[4 * RECORD_LANES];
+			std::size_t collapsed = size_1();  // (none yet)
+			for (std::size_t j=0; j < ys.size(); j++) {
+				std::size_t cell;
+				T v;
+				locate(ys[j], _lower[1], coord_step(1), size_1(), cell, v);
+				if (cell != collapsed) {
+					collapse_patch(record(i, cell), u, b);
+					collapsed = cell;
+				}
+				evaluate_collapsed(b, v, row.z0[j], row.c6[j], row.c12[j]);
+			}
+		}
+
+		// The potential at height z over a row whose parameters are known
+		static void render_row (T z, const RenderRow & row, T * out) {
+			typedef typename SimdBest<T>::type V;
+			std::size_t n = row.z0.size(), j = 0;
+			for (; j + V::width <= n; j += V::width)
+				lj_value(V(z) - V::load(&row.z0[j]), V::load(&row.c6[j]), V::load(&row.c12[j])).store(out + j);
+			for (; j < n; j++)
+				out[j] = lj_value(z - row.z0[j], row.c6[j], row.c12[j]);
+		}
+
+		// The potential at each height of zs over a single point
+		static void render_column (const std::vector<T> & zs, T p_z0, T c6, T c12, T * out) {
+			typedef typename SimdBest<T>::type V;
+			std::size_t n = zs.size(), k = 0;
+			for (; k + V::width <= n; k += V::width)
+				lj_value(V::load(&zs[k]) - V(p_z0), V(c6), V(c12)).store(out + k);
+			for (; k < n; k++)
+				out[k] = lj_value(zs[k] - p_z0, c6, c12);
+		}
+
+		// The cell containing x along an axis with at least 2 points, and the position
+		//  u in [0,1] within it (clamped to the lattice)
+		static void locate (T x, T lower, T step, std::size_t size, std::size_t & cell, T & u) {
+			T t = std::min(std::max((x - lower)/step, T(0)), T(size - 1));
+			cell = std::min(std::size_t(t), size - 2);
+			u = t - T(cell);
+		}
+
+		// Fills in the bicubic patch of each cell, in the record of its lower corner, as the
+		//  coefficients a[4p + q] of u^p v^q for (u,v) in [0,1]^2 across the cell.  Each
+		//  matches the parameter, and its derivatives estimated by finite differences, at
+		//  the cell's four corners.
+		void build_patches () {
+			if (!interpolating())
+				return;
+
+			std::size_t n0 = size_0(), n1 = size_1();
+			std::vector<T> fx(n0 * n1), fy(n0 * n1), fxy(n0 * n1);
+			auto at = [n1] (std::size_t i, std::size_t j) { return i * n1 + j; };
+
+			for (std::size_t lane=0; lane < 3; lane++) {
+				auto f = [&] (std::size_t i, std::size_t j) { return record(i, j)[lane]; };
+
+				// derivatives in units of the lattice step (central differences, or one-sided at the edges)
+				for (std::size_t i=0; i < n0; i++) {
+					for (std::size_t j=0; j < n1; j++) {
+						std::size_t il = (i > 0)? i-1 : i, ih = std::min(i+1, n0-1);
+						std::size_t jl = (j > 0)? j-1 : j, jh = std::min(j+1, n1-1);
+						fx[at(i,j)]  = (f(ih,j) - f(il,j)) / T(ih - il);
+						fy[at(i,j)]  = (f(i,jh) - f(i,jl)) / T(jh - jl);
+						fxy[at(i,j)] = (f(ih,jh) - f(ih,jl) - f(il,jh) + f(il,jl)) / T((ih - il) * (jh - jl));
+					}
+				}
+
+				// a = m g m^T, where g holds the values and derivatives at the corners
+				static const T m[4][4] = {{1, 0, 0, 0}, {0, 0, 1, 0}, {-3, 3, -2, -1}, {2, -2, 1, 1}};
+				for (std::size_t i=0; i+1 < n0; i++) {
+					for (std::size_t j=0; j+1 < n1; j++) {
+						const T g[4][4] = {
+							{ f(i,j),          f(i,j+1),          fy[at(i,j)],      fy[at(i,j+1)]    },
+							{ f(i+1,j),        f(i+1,j+1),        fy[at(i+1,j)],    fy[at(i+1,j+1)]  },
+							{ fx[at(i,j)],     fx[at(i,j+1)],     fxy[at(i,j)],     fxy[at(i,j+1)]   },
+							{ fx[at(i+1,j)],   fx[at(i+1,j+1)],   fxy[at(i+1,j)],   fxy[at(i+1,j+1)] },
+						};
+
+						// (the constant term is the fitted value itself, and stays as it is)
+						T * a = writable_record(i, j);
+						for (int p=0; p < 4; p++) {
+							for (int q=0; q < 4; q++) {
+								if (p == 0 && q == 0)
+									continue;
+								T sum = 0;
+								for (int r=0; r < 4; r++)
+									for (int s=0; s < 4; s++)
+										sum += m[p][r] * g[r][s] * m[q][s];
+								a[RECORD_LANES*(4*p + q) + lane] = sum;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		std::array<std::size_t, 2> _dims;
+		std::array<T, 2> _lower;  // coordinates of the first and last points along each axis
+		std::array<T, 2> _upper;
+		std::array<T, 2> _step;   // (kept, so that lookups need not divide to find it)
+
+		LJInterpolation _interpolation = LJInterpolation::Bicubic;
+		std::vector<T, AlignedAllocator<T, 64>> records;
+
+		std::shared_ptr<const MappedFile> _mapping;  // (when the records are in a file, instead)
+		const T * _mapped_records = nullptr;
 };
 
+template <class T> const std::size_t LJPseudoPotential<T>::RECORD_LANES;
+template <class T> const std::size_t LJPseudoPotential<T>::PATCH_TERMS;
+template <class T> const std::size_t LJPseudoPotential<T>::FILE_ALIGNMENT;
+
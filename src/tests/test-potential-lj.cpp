@@ -1,8 +1,14 @@
 #include "../external-deps/catch.hpp"
 
 #include <iostream>
+#include <random>
+#include <limits>
+#include <cmath>
+#include <type_traits>
 
 #include "../potential-lj.hpp"
+#include "../io/vasp-structures.hpp"
+#include "../numcomp.hpp"
 
 using namespace std;
 
@@ -58,3 +64,1129 @@ TEST_CASE("Behavior of LJ Potential beyond minimum") {
 		}
 	}
 }
+
+TEST_CASE("SIMD LJ kernel agrees with a plain serial loop") {
+	// deterministic cloud of particles with a mixture of attractive/repulsive terms
+	std::default_random_engine rng(1234);
+	std::uniform_real_distribution<double> coord(0., 10.);
+	std::uniform_real_distribution<double> param(0.5, 1.5);
+
+	// odd count so that the scalar remainder of the SIMD kernel gets exercised
+	const size_t n = 1003;
+
+	LJPotential<double> p;
+	vector<LJParticle<double>> reference;
+	for (size_t i=0; i<n; i++) {
+		LJParticle<double> particle {coord(rng), coord(rng), coord(rng), param(rng), param(rng)};
+		p.add_particle(particle);
+		reference.push_back(particle);
+	}
+
+	for (int trial=0; trial<20; trial++) {
+		double x = coord(rng), y = coord(rng), z = coord(rng);
+
+		// The loop that LJPotential originally used
+		double expected = 0.;
+		double magnitude = 0.;
+		for (auto particle : reference) {
+			double dx = x - particle.x, dy = y - particle.y, dz = z - particle.z;
+			double r_minus2 = (particle.length_unit * particle.length_unit) / (dx*dx + dy*dy + dz*dz);
+			double r_minus6 = r_minus2 * r_minus2 * r_minus2;
+			double term = particle.energy_unit * (r_minus6 - 2.0) * r_minus6;
+			expected  += term;
+			magnitude += fabs(term);
+		}
+
+		// documented tolerance from potential-lj/kernel.hpp
+		double width = LJKernel<double>::simd_width();
+		double tolerance = (n/width + width + 4) * numeric_limits<double>::epsilon() * magnitude;
+
+		REQUIRE(fabs(p.value_at(x, y, z) - expected) <= tolerance);
+		REQUIRE(fabs(lj_energy_scalar(p.particle_arrays().span(), p.species_table().probe_row(), x, y, z) - expected) <= tolerance);
+	}
+}
+
+TEST_CASE("Batched evaluation matches value_at") {
+	std::default_random_engine rng(42);
+	std::uniform_real_distribution<double> coord(0., 20.);
+
+	// enough particles and points to span several tiles and point blocks
+	LJPotential<double> p;
+	for (size_t i=0; i<1500; i++)
+		p.add_particle(coord(rng), coord(rng), coord(rng), 0.8, 1.1);
+
+	auto points = make_point_collection(Cartesian());
+	for (size_t j=0; j<150; j++)
+		points.push_back(RawPoint(coord(rng), coord(rng), coord(rng)));
+
+	SECTION("PointCollection interface") {
+		vector<double> out;
+		p.evaluate_into(points, out);
+
+		REQUIRE(out.size() == points.size());
+		for (size_t j=0; j<points.size(); j++)
+			REQUIRE(out[j] == p.value_at(points[j][0], points[j][1], points[j][2]));
+
+		REQUIRE(p.value_at_many(points) == out);
+	}
+
+	SECTION("Raw array interface") {
+		vector<double> xs, ys, zs;
+		for (size_t j=0; j<points.size(); j++) {
+			xs.push_back(points[j][0]);
+			ys.push_back(points[j][1]);
+			zs.push_back(points[j][2]);
+		}
+
+		vector<double> out(points.size());
+		p.value_at_many(xs.data(), ys.data(), zs.data(), out.size(), out.data());
+		for (size_t j=0; j<points.size(); j++)
+			REQUIRE(out[j] == p.value_at(xs[j], ys[j], zs[j]));
+	}
+}
+
+// A simple cubic slab of particles, nx*ny*nz, spacing 1, with its top layer at z=0
+void fill_slab(LJPotential<double> & p, int nx, int ny, int nz, double emin, double rmin)
+{
+	for (int i=0; i<nx; i++)
+		for (int j=0; j<ny; j++)
+			for (int k=0; k<nz; k++)
+				p.add_particle(i, j, -k, emin, rmin);
+}
+
+TEST_CASE("LJ potential with a cutoff") {
+	LJPotential<double> p;
+	fill_slab(p, 40, 40, 4, 0.5, 1.2);
+
+	// probe above the middle of the slab
+	double x = 19.3, y = 20.1, z = 1.4;
+	double full = p.value_at(x, y, z);
+
+	SECTION("Matches a truncated brute-force sum") {
+		double cutoff = 3.5;
+		p.set_cutoff(cutoff).set_tail_correction(false);
+
+		LJPotential<double> reference;
+		auto & arrays = p.particle_arrays();
+		for (size_t i=0; i < p.size(); i++) {
+			double dx = x - arrays.x()[i], dy = y - arrays.y()[i], dz = z - arrays.z()[i];
+			if (dx*dx + dy*dy + dz*dz < cutoff*cutoff)
+				reference.add_particle(arrays.x()[i], arrays.y()[i], arrays.z()[i], 0.5, 1.2);
+		}
+
+		REQUIRE(reference.size() < p.size() / 10);
+		REQUIRE(p.value_at(x, y, z) == Approx(reference.value_at(x, y, z)));
+	}
+
+	SECTION("A cutoff larger than the sample changes nothing") {
+		p.set_cutoff(1000.).set_tail_correction(false);
+		REQUIRE(p.value_at(x, y, z) == Approx(full));
+	}
+
+	SECTION("Tail correction reduces the truncation error") {
+		p.set_cutoff(3.);
+
+		double corrected = p.value_at(x, y, z);
+		p.set_tail_correction(false);
+		double truncated = p.value_at(x, y, z);
+
+		REQUIRE(truncated > full); // the missing part is attractive
+		REQUIRE(fabs(corrected - full) < 0.2 * fabs(truncated - full));
+	}
+
+	SECTION("Cutoff chosen from a tolerance") {
+		for (double tol : {1E-2, 1E-3}) {
+			p.set_cutoff_for_tolerance(tol);
+			REQUIRE(p.truncation_error_bound(p.cutoff()) == Approx(tol));
+
+			p.set_tail_correction(false);
+			REQUIRE(fabs(p.value_at(x, y, z) - full) <= tol);
+			p.set_tail_correction(true);
+			REQUIRE(fabs(p.value_at(x, y, z) - full) <= tol);
+		}
+	}
+
+	SECTION("Batched evaluation honors the cutoff") {
+		p.set_cutoff(3.);
+		vector<double> xs = {x, 5., 30.}, ys = {y, 5., 2.}, zs = {z, 1., 2.};
+		vector<double> out(3);
+		p.value_at_many(xs.data(), ys.data(), zs.data(), 3, out.data());
+		for (size_t j=0; j<3; j++)
+			REQUIRE(out[j] == p.value_at(xs[j], ys[j], zs[j]));
+	}
+
+	SECTION("Adding particles requires finalize()") {
+		p.set_cutoff(3.);
+		double before = p.value_at(x, y, z);
+
+		p.add_particle(x, y, -1., 0.5, 1.2);
+		REQUIRE_THROWS_AS(p.value_at(x, y, z), std::logic_error);
+
+		p.finalize();
+		REQUIRE(p.value_at(x, y, z) < before);
+	}
+}
+
+TEST_CASE("Periodic LJ potential") {
+	// a 4x4 two-layer cell, slightly skewed so that the lattice isn't trivially cartesian
+	LJPotential<double>::Vector a {{4., 0., 0.}}, b {{1., 4., 0.}}, c {{0., 0., 30.}};
+
+	auto add_cell = [&] (LJPotential<double> & p, int na, int nb) {
+		for (int i=0; i<4; i++)
+			for (int j=0; j<4; j++)
+				for (int k=0; k<2; k++) {
+					double u = i + 0.25*k, v = j + 0.25*k;
+					p.add_particle(
+						u + na*a[0] + nb*b[0] + 0.25*v,
+						v + na*a[1] + nb*b[1],
+						-1.0*k,
+						0.7, 1.1);
+				}
+	};
+
+	LJPotential<double> periodic;
+	add_cell(periodic, 0, 0);
+	periodic.set_periodic(a, b, c);
+
+	// probe points, including some well outside the home cell
+	vector<array<double,3>> probes = {{
+		{{1.3, 2.1, 1.5}}, {{-7.3, 2.2, 1.1}}, {{3.9, 13.7, 0.8}}, {{0.1, 0.1, -3.}},
+	}};
+
+	SECTION("Bounded image sum matches explicit replicas") {
+		for (unsigned n : {1u, 2u}) {
+			LJPotential<double> replicas;
+			for (int na=-int(n); na<=int(n); na++)
+				for (int nb=-int(n); nb<=int(n); nb++)
+					add_cell(replicas, na, nb);
+
+			periodic.set_image_count(n);
+			for (auto & q : probes)
+				REQUIRE(periodic.value_at(q[0], q[1], q[2]) == Approx(replicas.value_at(q[0], q[1], q[2])));
+		}
+	}
+
+	SECTION("With a cutoff, matches a cutoff over many explicit replicas") {
+		double cutoff = 9.;
+		LJPotential<double> replicas;
+		for (int na=-6; na<=6; na++)
+			for (int nb=-6; nb<=6; nb++)
+				add_cell(replicas, na, nb);
+
+		replicas.set_cutoff(cutoff).set_tail_correction(false);
+		periodic.set_cutoff(cutoff).set_tail_correction(false);
+
+		for (auto & q : {probes[0], probes[3]})
+			REQUIRE(periodic.value_at(q[0], q[1], q[2]) == Approx(replicas.value_at(q[0], q[1], q[2])));
+	}
+
+	SECTION("Invariant under lattice translations") {
+		periodic.set_cutoff(6.);
+		auto & q = probes[0];
+		double expected = periodic.value_at(q[0], q[1], q[2]);
+		REQUIRE(periodic.value_at(q[0] + 2*a[0] - b[0], q[1] + 2*a[1] - b[1], q[2]) == Approx(expected));
+	}
+
+	SECTION("Cell taken from a VaspLatticeCell") {
+		VaspLatticeCell vasp;
+		vasp.set_vector(0, {{2., 0., 0.}});
+		vasp.set_vector(1, {{0.5, 2., 0.}});
+		vasp.set_vector(2, {{0., 0., 15.}});
+		vasp.set_scale(2.);
+
+		LJPotential<double> from_vasp;
+		add_cell(from_vasp, 0, 0);
+		from_vasp.set_periodic(vasp);
+
+		for (auto & q : probes)
+			REQUIRE(from_vasp.value_at(q[0], q[1], q[2]) == periodic.value_at(q[0], q[1], q[2]));
+	}
+}
+
+// Checks evaluate() against finite differences of value_at()
+template <class Potential>
+void check_derivatives(const Potential & p, double x, double y, double z)
+{
+	auto eval = p.evaluate(x, y, z, true);
+	REQUIRE(eval.energy == Approx(p.value_at(x, y, z)));
+
+	double step = 1E-4;
+	double point[3] = {x, y, z};
+	for (int i=0; i<3; i++) {
+		// energy along axis i
+		auto energy_along = [&] (double t) {
+			double q[3] = {x, y, z};
+			q[i] = t;
+			return p.value_at(q[0], q[1], q[2]);
+		};
+		REQUIRE(-eval.force[i] == Approx(differentiate_5point(energy_along, point[i], step)).epsilon(1E-6));
+
+		for (int j=0; j<3; j++) {
+			// force component j along axis i
+			auto force_along = [&] (double t) {
+				double q[3] = {x, y, z};
+				q[i] = t;
+				return p.evaluate(q[0], q[1], q[2]).force[j];
+			};
+			REQUIRE(eval.hessian[i][j] == Approx(-differentiate_5point(force_along, point[i], step)).epsilon(1E-6));
+			REQUIRE(eval.hessian[i][j] == eval.hessian[j][i]);
+		}
+	}
+
+	// the hessian is optional
+	auto without = p.evaluate(x, y, z);
+	REQUIRE(without.force == eval.force);
+	REQUIRE(without.hessian[2][2] == 0.);
+}
+
+TEST_CASE("Fused energy, force and Hessian of LJ potential") {
+	SECTION("Single particle, force points away from it inside the minimum") {
+		LJPotential<double> p;
+		p.add_particle(0., 0., 0., 1., 2.);
+
+		auto inside = p.evaluate(0., 0., 1.5);
+		REQUIRE(inside.force[0] == 0.);
+		REQUIRE(inside.force[2] > 0.);
+
+		auto at_min = p.evaluate(0., 0., 2.);
+		REQUIRE(at_min.energy == Approx(-1.));
+		REQUIRE(fabs(at_min.force[2]) < 1E-12);
+	}
+
+	SECTION("Random cluster") {
+		std::default_random_engine rng(7);
+		std::uniform_real_distribution<double> coord(0., 6.);
+
+		LJPotential<double> p;
+		for (int i=0; i<101; i++)
+			p.add_particle(coord(rng), coord(rng), coord(rng), 0.8, 1.1);
+
+		check_derivatives(p, 3.1, 2.9, 8.0);
+		check_derivatives(p, -1.0, 4.2, 3.3);
+	}
+
+	SECTION("Periodic slab with cutoff and tail correction") {
+		LJPotential<double> p;
+		fill_slab(p, 6, 6, 3, 0.5, 1.2);
+		p.set_periodic({{6., 0., 0.}}, {{0., 6., 0.}}, {{0., 0., 40.}});
+		p.set_cutoff(4.);
+
+		check_derivatives(p, 2.3, 3.4, 1.7);
+		check_derivatives(p, 0.2, 5.1, 6.5); // far enough that the tail's curvature matters
+	}
+}
+
+TEST_CASE("Evaluating LJ potential on a lattice") {
+	LJPotential<double> p;
+	fill_slab(p, 12, 12, 3, 0.5, 1.2);
+
+	auto lattice = Lattice3<double> {9, 7, 11}
+		.set_lower_coords(2.3, 3.1, 0.6)
+		.set_upper_coords(8.7, 7.9, 4.1)
+	;
+
+	auto require_matches_value_at = [&] (const LJPotential<double> & pot) {
+		evaluate_on_lattice(pot, lattice, 1);
+		for (size_t i=0; i < lattice.size_0(); i++)
+			for (size_t j=0; j < lattice.size_1(); j++)
+				for (size_t k=0; k < lattice.size_2(); k++) {
+					double x = lattice.coord_0(i), y = lattice.coord_1(j), z = lattice.coord_2(k);
+					REQUIRE(lattice(i, j, k) == Approx(pot.value_at(x, y, z)));
+				}
+	};
+
+	SECTION("Without a cutoff") {
+		require_matches_value_at(p);
+	}
+
+	SECTION("With a cutoff and tail correction") {
+		p.set_cutoff(3.);
+		require_matches_value_at(p);
+	}
+
+	SECTION("Periodic, with and without a cutoff") {
+		p.set_periodic({{12., 0., 0.}}, {{0., 12., 0.}}, {{0., 0., 30.}});
+		require_matches_value_at(p);
+		p.set_cutoff(5.);
+		require_matches_value_at(p);
+	}
+
+	SECTION("Independent of the thread count") {
+		p.set_cutoff(4.);
+		evaluate_on_lattice(p, lattice, 1);
+		auto serial = lattice;
+		evaluate_on_lattice(p, lattice, 3);
+		REQUIRE(lattice == serial);
+	}
+
+	SECTION("Adding particles requires finalize()") {
+		p.set_cutoff(3.);
+		p.add_particle(5., 5., 1., 0.5, 1.2);
+		REQUIRE_THROWS_AS(evaluate_on_lattice(p, lattice), std::logic_error);
+	}
+}
+
+TEST_CASE("Far-field LJ potential") {
+	std::default_random_engine rng(11);
+	std::uniform_real_distribution<double> jitter(-0.15, 0.15);
+
+	LJPotential<double> p;
+	for (int i=0; i<40; i++)
+		for (int j=0; j<40; j++)
+			for (int k=0; k<4; k++)
+				p.add_particle(i + jitter(rng), j + jitter(rng), -k + jitter(rng), 0.5, 1.2);
+
+	vector<array<double,3>> probes = {{
+		{{19.3, 20.1, 1.4}}, {{3.2, 35.5, 2.5}}, {{-6., 12., 0.5}}, {{20., 20., 15.}},
+	}};
+	vector<double> exact;
+	for (auto & q : probes)
+		exact.push_back(p.value_at(q[0], q[1], q[2]));
+
+	SECTION("Converges to the full sum as the opening angle shrinks") {
+		vector<pair<double, double>> theta_tol = {{0.2, 1E-2}, {0.1, 1E-3}, {0.05, 1E-5}};
+		for (auto & tt : theta_tol) {
+			p.set_far_field(tt.first);
+			double tol = tt.second;
+			for (size_t i=0; i < probes.size(); i++) {
+				auto & q = probes[i];
+				REQUIRE(fabs(p.value_at(q[0], q[1], q[2]) - exact[i]) <= tol * fabs(exact[i]));
+			}
+		}
+	}
+
+	SECTION("Opening angles outside (0, 1) are refused") {
+		p.set_cutoff(3.);
+		for (double theta : {0., 1., 1.5, -0.2, std::nan("")})
+			REQUIRE_THROWS_AS(p.set_far_field(theta), std::invalid_argument);
+		REQUIRE(p.has_cutoff());
+		REQUIRE(!p.has_far_field());
+	}
+
+	SECTION("Replaces a cutoff, and vice versa") {
+		p.set_cutoff(3.);
+		p.set_far_field(0.2);
+		REQUIRE(!p.has_cutoff());
+		p.set_cutoff(3.);
+		REQUIRE(!p.has_far_field());
+	}
+
+	SECTION("Derivatives of the cluster expansion") {
+		// far enough away that the whole sample is one cluster
+		p.set_far_field(0.9);
+		check_derivatives(p, 15., 60., 30.);
+
+		// a mix of exact leaves and clusters
+		p.set_far_field(0.3);
+		check_derivatives(p, 19.3, 20.1, 1.4);
+	}
+
+	SECTION("Batched and lattice evaluation") {
+		p.set_far_field(0.3);
+		vector<double> xs, ys, zs;
+		for (auto & q : probes) {
+			xs.push_back(q[0]);
+			ys.push_back(q[1]);
+			zs.push_back(q[2]);
+		}
+		vector<double> out(probes.size());
+		p.value_at_many(xs.data(), ys.data(), zs.data(), out.size(), out.data());
+		for (size_t i=0; i < probes.size(); i++)
+			REQUIRE(out[i] == p.value_at(xs[i], ys[i], zs[i]));
+
+		auto lattice = Lattice3<double> {3, 3, 3}
+			.set_lower_coords(5., 5., 1.)
+			.set_upper_coords(9., 9., 3.)
+		;
+		evaluate_on_lattice(p, lattice, 2);
+		REQUIRE(lattice(1, 2, 0) == p.value_at(7., 9., 1.));
+	}
+
+	SECTION("Adding particles requires finalize()") {
+		p.set_far_field(0.3);
+		p.add_particle(0., 0., 1., 0.5, 1.2);
+		REQUIRE_THROWS_AS(p.value_at(0., 0., 2.), std::logic_error);
+	}
+}
+
+TEST_CASE("LJ species and mixing rules") {
+	LJPotential<double> p;
+	auto carbon   = p.add_species(0.4, 3.8);
+	auto hydrogen = p.add_species(0.1, 2.6);
+	auto probe    = p.add_species(0.9, 3.0);
+
+	std::default_random_engine rng(5);
+	std::uniform_real_distribution<double> coord(0., 8.);
+	vector<array<double,3>> positions;
+	for (int i=0; i<60; i++) {
+		positions.push_back({{coord(rng), coord(rng), coord(rng) - 8.}});
+		p.add_particle(positions[i][0], positions[i][1], positions[i][2], (i % 3)? carbon : hydrogen);
+	}
+
+	// the same sample, with the pair parameters spelled out for each particle
+	auto explicit_sample = [&] (LJParameters<double> with_carbon, LJParameters<double> with_hydrogen) {
+		LJPotential<double> q;
+		for (int i=0; i<60; i++) {
+			auto & pair = (i % 3)? with_carbon : with_hydrogen;
+			q.add_particle(positions[i][0], positions[i][1], positions[i][2], pair.energy_unit, pair.length_unit);
+		}
+		return q;
+	};
+
+	auto require_same = [&] (const LJPotential<double> & a, const LJPotential<double> & b) {
+		for (double z : {1.5, 3., 6.})
+			REQUIRE(a.value_at(4.1, 3.7, z) == Approx(b.value_at(4.1, 3.7, z)));
+	};
+
+	SECTION("Without a probe species, each species' own parameters are used") {
+		require_same(p, explicit_sample({0.4, 3.8}, {0.1, 2.6}));
+	}
+
+	SECTION("Lorentz-Berthelot by default") {
+		p.set_probe_species(probe);
+		auto pair = p.species_table().pair(probe, carbon);
+		REQUIRE(pair.energy_unit == Approx(sqrt(0.4 * 0.9)));
+		REQUIRE(pair.length_unit == Approx(3.4));
+
+		require_same(p, explicit_sample({sqrt(0.4 * 0.9), 3.4}, {sqrt(0.1 * 0.9), 2.8}));
+	}
+
+	SECTION("Custom mixing rule and explicit pairs") {
+		p.set_probe_species(probe)
+			.set_mixing_rule(LJSpeciesTable<double>::geometric)
+			.set_pair_parameters(hydrogen, probe, 0.25, 2.5)
+		;
+		require_same(p, explicit_sample({sqrt(0.4 * 0.9), sqrt(3.8 * 3.0)}, {0.25, 2.5}));
+
+		p.clear_probe_species();
+		require_same(p, explicit_sample({0.4, 3.8}, {0.1, 2.6}));
+	}
+
+	SECTION("Per-particle parameters share species") {
+		LJPotential<double> q;
+		for (int i=0; i<30; i++)
+			q.add_particle(i, 0., 0., (i % 2)? 0.5 : 0.7, 1.2);
+		REQUIRE(q.size() == 30);
+		REQUIRE(q.species_table().size() == 2);
+	}
+
+	SECTION("Particles from a VaspParticleList") {
+		VaspParticleList list;
+		list.add_species(40);
+		list.add_species(20);
+		for (size_t i=0; i<60; i++)
+			list.coords(i) = {{positions[i][0], positions[i][1], positions[i][2]}};
+
+		LJPotential<double> q;
+		q.add_species(0.4, 3.8);
+		q.add_species(0.1, 2.6);
+		q.add_particles(list, {1, 0});
+
+		LJPotential<double> expected;
+		for (size_t i=0; i<60; i++)
+			expected.add_particle(positions[i][0], positions[i][1], positions[i][2], (i < 40)? 0.1 : 0.4, (i < 40)? 2.6 : 3.8);
+		require_same(q, expected);
+	}
+
+	SECTION("Unknown species") {
+		REQUIRE_THROWS_AS(p.add_particle(0., 0., 0., LJSpeciesIndex(7)), std::out_of_range);
+		REQUIRE_THROWS_AS(p.set_probe_species(7), std::out_of_range);
+	}
+}
+
+TEST_CASE("Compile-time integer powers") {
+	for (double x : {0.3, 1., 1.7, -2.2}) {
+		REQUIRE(ipow<0>(x) == 1.);
+		REQUIRE(ipow<1>(x) == x);
+		REQUIRE(ipow<3>(x) == x * x * x);
+		REQUIRE(ipow<6>(x)   == Approx(pow(x, 6)));
+		REQUIRE(ipow<13>(x)  == Approx(pow(x, 13)));
+		REQUIRE(ipow<-7>(x)  == Approx(pow(x, -7)));
+		REQUIRE(ipow<-28>(x) == Approx(pow(x, -28)));
+	}
+	REQUIRE(half_ipow<-9>(0.25, 0.5) == Approx(pow(0.5, -9)));
+	REQUIRE(half_ipow<8>(0.25, 0.5) == Approx(pow(0.5, 8)));
+}
+
+// Mie potential of a single particle, straight from the definition
+double mie_reference(int n, int m, double eps, double rm, double r)
+{
+	return eps / (n - m) * (m * pow(rm / r, n) - n * pow(rm / r, m));
+}
+
+template <int N, int M>
+void check_mie(double cutoff)
+{
+	MiePotential<double, N, M> single;
+	single.add_particle(1., 2., 3., 0.7, 1.3);
+
+	// depth and position of the minimum
+	REQUIRE(single.value_at(1., 2., 4.3) == Approx(-0.7));
+	REQUIRE(fabs(single.evaluate(1., 2., 4.3).force[2]) < 1E-12);
+	for (double r : {0.9, 1.3, 2.0, 5.5})
+		REQUIRE(single.value_at(1., 2. + r, 3.) == Approx(mie_reference(N, M, 0.7, 1.3, r)));
+
+	// a cluster with mixed parameters, including the SIMD remainder
+	std::default_random_engine rng(N * 100 + M);
+	std::uniform_real_distribution<double> coord(0., 6.);
+	std::uniform_real_distribution<double> param(0.5, 1.5);
+	MiePotential<double, N, M> p;
+	double positions[37][5];
+	for (auto & q : positions) {
+		for (int k=0; k<3; k++)
+			q[k] = coord(rng);
+		q[3] = param(rng);
+		q[4] = param(rng);
+		p.add_particle(q[0], q[1], q[2], q[3], q[4]);
+	}
+
+	auto exact = [&] (double x, double y, double z) {
+		double sum = 0.;
+		for (auto & q : positions)
+			sum += mie_reference(N, M, q[3], q[4], sqrt(pow(x - q[0], 2) + pow(y - q[1], 2) + pow(z - q[2], 2)));
+		return sum;
+	};
+	REQUIRE(p.value_at(3.1, 2.9, 8.) == Approx(exact(3.1, 2.9, 8.)).epsilon(1E-12));
+	check_derivatives(p, 3.1, 2.9, 8.0);
+
+	p.set_cutoff(cutoff);
+	check_derivatives(p, 3.1, 2.9, 7.0);
+
+	p.set_far_field(0.2);
+	REQUIRE(p.value_at(3.1, 2.9, 25.) == Approx(exact(3.1, 2.9, 25.)).epsilon(1E-3));
+	check_derivatives(p, 3.1, 2.9, 25.);
+}
+
+TEST_CASE("Mie potentials") {
+	REQUIRE((std::is_same<LJPotential<double>, MiePotential<double, 12, 6>>::value));
+
+	SECTION("12-6") { check_mie<12, 6>(4.); }
+	SECTION("9-6")  { check_mie<9, 6>(4.); }
+	SECTION("14-7") { check_mie<14, 7>(4.); }
+	SECTION("16-6") { check_mie<16, 6>(4.); }
+}
+
+TEST_CASE("Editing particles and patching a lattice") {
+	std::default_random_engine rng(11);
+	std::uniform_real_distribution<double> jitter(-0.1, 0.1);
+
+	LJPotential<double> p;
+	fill_slab(p, 8, 8, 3, 0.5, 1.2);
+	LJSpeciesIndex adsorbate = p.add_species(0.9, 1.6);
+
+	// (the patched values are only as accurate as the terms being subtracted, so the edits
+	//  keep some distance from the points)
+	Lattice3<double> lattice(9, 10, 12);
+	lattice.set_lower_coords(0.5, 0.3, 3.).set_upper_coords(7.1, 6.9, 8.);
+
+	// patches the lattice for a few edits, and compares with a fresh evaluation
+	auto check_edits = [&] () {
+		evaluate_on_lattice(p, lattice);
+
+		p.add_particle(3.2, 3.9, 2.1, adsorbate, lattice);
+		p.move_particle(5, 2.5 + jitter(rng), 0.2, 0.4, lattice);
+		p.remove_particle(70, lattice);
+		p.move_particle(p.size() - 1, 4.4, 3.3, 1.8, lattice);
+
+		Lattice3<double> fresh = lattice;
+		evaluate_on_lattice(p, fresh);
+		for (size_t i=0; i < lattice.size_0(); i++)
+			for (size_t j=0; j < lattice.size_1(); j++)
+				for (size_t k=0; k < lattice.size_2(); k++)
+					REQUIRE(lattice(i, j, k) == Approx(fresh(i, j, k)).epsilon(1E-10));
+	};
+
+	SECTION("Full sum") { check_edits(); }
+
+	SECTION("Cutoff, with the tail correction") {
+		p.set_cutoff(2.5);
+		check_edits();
+	}
+
+	SECTION("Periodic slab with cutoff") {
+		p.set_periodic({{8., 0., 0.}}, {{0., 8., 0.}}, {{0., 0., 40.}});
+		p.set_cutoff(3.);
+		check_edits();
+	}
+
+	SECTION("Periodic slab without cutoff") {
+		p.set_periodic({{8., 0., 0.}}, {{0., 8., 0.}}, {{0., 0., 40.}});
+		check_edits();
+	}
+
+	SECTION("Editing without a lattice requires finalize() in cutoff mode") {
+		p.set_cutoff(2.5);
+		size_t n = p.size();
+
+		p.move_particle(0, 1., 1., 1.);
+		REQUIRE_THROWS_AS(p.value_at(1., 1., 3.), std::logic_error);
+		p.remove_particle(1);
+		p.finalize();
+		REQUIRE(p.size() == n - 1);
+		REQUIRE(p.particle_arrays().x()[0] == 1.);
+
+		REQUIRE_THROWS_AS(p.move_particle(n, 0., 0., 0.), std::out_of_range);
+		REQUIRE_THROWS_AS(p.remove_particle(n - 1, lattice), std::out_of_range);
+	}
+}
+
+TEST_CASE("Tabulated pair potentials") {
+	LJPotential<double> p;
+	fill_slab(p, 12, 12, 3, 0.5, 1.2);
+	LJSpeciesIndex adsorbate = p.add_species(0.9, 1.6);
+	p.add_particle(5.3, 6.1, 1.1, adsorbate);
+	p.set_cutoff(3.);
+
+	vector<array<double, 3>> probes = {{
+		{{5.3, 6.1, 2.4}}, {{4.5, 4.5, 1.0}}, {{7.2, 3.9, 1.7}}, {{6., 6., 3.5}},
+	}};
+
+	SECTION("Matches the analytic potential to within the measured error") {
+		vector<double> exact;
+		for (auto & q : probes)
+			exact.push_back(p.value_at(q[0], q[1], q[2]));
+
+		p.set_tabulation(2048);
+		REQUIRE(p.has_tabulation());
+		REQUIRE(p.tabulation_error() < 1E-6);
+		for (size_t i=0; i < probes.size(); i++) {
+			auto & q = probes[i];
+			REQUIRE(p.value_at(q[0], q[1], q[2]) == Approx(exact[i]).epsilon(1E-6));
+		}
+
+		// evaluate() stays analytic
+		auto & q = probes[0];
+		REQUIRE(p.evaluate(q[0], q[1], q[2]).energy == Approx(exact[0]).epsilon(1E-12));
+	}
+
+	SECTION("The error falls as the table is refined") {
+		p.set_tabulation(64);
+		double coarse = p.tabulation_error();
+		p.set_tabulation(256);
+		REQUIRE(p.tabulation_error() < coarse / 16);
+
+		p.set_tabulation_for_tolerance(1E-8);
+		REQUIRE(p.tabulation_error() <= 1E-8);
+		REQUIRE_THROWS_AS(p.set_tabulation_for_tolerance(1E-300), std::runtime_error);
+		REQUIRE(!p.has_tabulation());
+	}
+
+	SECTION("Custom pair functions") {
+		// Morse, with its well at r_m
+		auto morse = [] (const LJParameters<double> & pair, double r2) {
+			double e = exp(-1.5 * (sqrt(r2) - pair.length_unit));
+			return pair.energy_unit * (e * e - 2 * e);
+		};
+		p.set_tabulation(2048, morse);
+
+		auto & arrays = p.particle_arrays();
+		for (auto & q : probes) {
+			double expected = 0;
+			for (size_t i=0; i < arrays.size(); i++) {
+				double dx = q[0] - arrays.x()[i], dy = q[1] - arrays.y()[i], dz = q[2] - arrays.z()[i];
+				double r2 = dx*dx + dy*dy + dz*dz;
+				if (r2 < 9.)
+					expected += morse(p.species_table().with_probe(arrays.species()[i]), r2);
+			}
+			// (no tail correction for a custom function)
+			REQUIRE(p.value_at(q[0], q[1], q[2]) == Approx(expected).epsilon(1E-7));
+		}
+
+		REQUIRE_THROWS_AS(p.evaluate(5., 5., 2.), std::logic_error);
+	}
+
+	SECTION("Lattices and patches use the table") {
+		p.set_tabulation(256);
+		Lattice3<double> lattice(6, 7, 5);
+		lattice.set_lower_coords(2., 2.5, 2.).set_upper_coords(7., 8.5, 4.);
+		evaluate_on_lattice(p, lattice);
+		REQUIRE(lattice(3, 2, 1) == Approx(p.value_at(5., 4.5, 2.5)).epsilon(1E-12));
+
+		p.move_particle(40, 3.1, 3.4, 0.2, lattice);
+		Lattice3<double> fresh = lattice;
+		evaluate_on_lattice(p, fresh);
+		for (size_t i=0; i < lattice.size_0(); i++)
+			for (size_t j=0; j < lattice.size_1(); j++)
+				for (size_t k=0; k < lattice.size_2(); k++)
+					REQUIRE(lattice(i, j, k) == Approx(fresh(i, j, k)).epsilon(1E-10));
+
+		// (a refused particle leaves no new species behind)
+		size_t species_count = p.species_table().size();
+		size_t particle_count = p.particle_arrays().size();
+		REQUIRE_THROWS_AS(p.add_particle(1., 1., 1., 0.2, 0.6, lattice), std::logic_error);
+		REQUIRE(p.species_table().size() == species_count);
+		REQUIRE(p.particle_arrays().size() == particle_count);
+
+		p.add_species(0.3, 0.4);
+		REQUIRE_THROWS_AS(p.add_particle(1., 1., 1., 0.3, 0.4, lattice), std::logic_error);
+	}
+
+	SECTION("A cutoff chosen from a tolerance keeps the table") {
+		LJPotential<double> analytic = p;
+		analytic.set_cutoff_for_tolerance(1E-2);
+
+		p.set_tabulation(8192);
+		p.set_cutoff_for_tolerance(1E-2);
+		REQUIRE(p.has_tabulation());
+		REQUIRE(p.cutoff() == analytic.cutoff());
+		REQUIRE(p.tabulation_error() < 1E-5);
+		for (auto & q : probes)
+			REQUIRE(p.value_at(q[0], q[1], q[2]) == Approx(analytic.value_at(q[0], q[1], q[2])).epsilon(1E-5));
+	}
+
+	SECTION("Requires a cutoff") {
+		p.set_tabulation(64);
+		p.clear_cutoff();
+		REQUIRE(!p.has_tabulation());
+		REQUIRE_THROWS_AS(p.set_tabulation(64), std::logic_error);
+	}
+}
+
+TEST_CASE("Pair tables index their coefficients exactly") {
+	// float represents whole numbers exactly up to 2^24: at 2^16 intervals per species
+	//  (2^18 coefficients, with the spare interval), 64 species fit and 65 do not
+	REQUIRE(LJPairTable<float>::max_coefficients() == size_t(1) << 24);
+	REQUIRE(LJPairTable<double>::max_coefficients() == size_t(1) << 31);
+
+	LJSpeciesTable<float> species;
+	for (int s=0; s < 64; s++)
+		species.add_species(1.f + s, 1.f);
+	auto f = [] (const LJParameters<float> & pair, float u) { return pair.energy_unit / u; };
+	size_t intervals = (size_t(1) << 16) - 1;
+
+	LJPairTable<float> table;
+	table.build(species, f, 1.f, 2.f, intervals);
+	for (float u : {1.f, 1.37f, 1.99f})
+		REQUIRE(table.energy(LJSpeciesIndex(63), u) == Approx(64.f / u).epsilon(1E-5));
+
+	species.add_species(100.f, 1.f);
+	REQUIRE_THROWS_AS(table.build(species, f, 1.f, 2.f, intervals), std::invalid_argument);
+	REQUIRE(table.species_count() == 64);
+}
+
+TEST_CASE("Space-filling curves") {
+	SECTION("Morton keys interleave the bits") {
+		REQUIRE(morton_key(1, 0, 0) == 4u);
+		REQUIRE(morton_key(0, 1, 0) == 2u);
+		REQUIRE(morton_key(0, 0, 1) == 1u);
+		REQUIRE(morton_key(3, 5, 6) == 0xeeu); // (011, 101, 110) -> 011 101 110
+		REQUIRE(morton_key(0x1fffff, 0x1fffff, 0x1fffff) == (uint64_t(1) << 63) - 1);
+	}
+
+	SECTION("Hilbert keys visit an 8x8x8 grid one face step at a time") {
+		const uint32_t n = 8;
+		vector<array<uint32_t, 3>> cells;
+		for (uint32_t x=0; x<n; x++)
+			for (uint32_t y=0; y<n; y++)
+				for (uint32_t z=0; z<n; z++)
+					cells.push_back({{x, y, z}});
+
+		// (each cell of the coarse grid is a contiguous block of the full curve)
+		const int shift = CURVE_BITS - 3;
+		sort(cells.begin(), cells.end(), [&] (const array<uint32_t, 3> & a, const array<uint32_t, 3> & b) {
+			return hilbert_key(a[0] << shift, a[1] << shift, a[2] << shift)
+			     < hilbert_key(b[0] << shift, b[1] << shift, b[2] << shift);
+		});
+
+		for (size_t k=1; k < cells.size(); k++) {
+			int steps = 0;
+			for (int a=0; a<3; a++)
+				steps += abs(int(cells[k][a]) - int(cells[k-1][a]));
+			REQUIRE(steps == 1);
+		}
+	}
+}
+
+TEST_CASE("Reordering particles along a space-filling curve") {
+	// grouped by species, as from a VASP file
+	LJPotential<double> p;
+	LJSpeciesIndex a = p.add_species(0.5, 1.2);
+	LJSpeciesIndex b = p.add_species(0.9, 1.6);
+	for (int i=0; i<10; i++)
+		for (int j=0; j<10; j++)
+			p.add_particle(i, j, 0., a);
+	for (int i=0; i<10; i++)
+		for (int j=0; j<10; j++)
+			p.add_particle(i + 0.5, j + 0.5, -0.7, b);
+
+	LJParticleArrays<double> before = p.particle_arrays();
+	vector<array<double, 3>> probes = {{ {{4.3, 5.1, 1.4}}, {{0.2, 8.8, 2.0}}, {{6.6, 2.5, 1.1}} }};
+	auto values = [&] () {
+		vector<double> out;
+		for (auto & q : probes)
+			out.push_back(p.value_at(q[0], q[1], q[2]));
+		return out;
+	};
+
+	auto check_reorder = [&] (SpaceFillingCurve curve) {
+		vector<double> expected = values();
+		p.reorder(curve);
+		REQUIRE(p.size() == before.size());
+
+		// a permutation that maps each particle back to where it came from
+		auto & after = p.particle_arrays();
+		vector<bool> seen(p.size(), false);
+		for (size_t i=0; i < p.size(); i++) {
+			size_t o = p.original_index(i);
+			REQUIRE(!seen[o]);
+			seen[o] = true;
+			REQUIRE(after.x()[i] == before.x()[o]);
+			REQUIRE(after.y()[i] == before.y()[o]);
+			REQUIRE(after.z()[i] == before.z()[o]);
+			REQUIRE(after.species()[i] == before.species()[o]);
+		}
+
+		// the species are now mixed together
+		size_t first_half_b = count(after.species().begin(), after.species().begin() + p.size() / 2, b);
+		REQUIRE(first_half_b > 0);
+		REQUIRE(first_half_b < p.size() / 2);
+
+		vector<double> actual = values();
+		for (size_t k=0; k < probes.size(); k++)
+			REQUIRE(actual[k] == Approx(expected[k]).epsilon(1E-12));
+	};
+
+	SECTION("Hilbert") { check_reorder(SpaceFillingCurve::Hilbert); }
+	SECTION("Morton")  { check_reorder(SpaceFillingCurve::Morton); }
+
+	SECTION("With a cutoff") {
+		p.set_cutoff(2.5);
+		check_reorder(SpaceFillingCurve::Hilbert);
+	}
+
+	SECTION("Original indices follow edits") {
+		p.reorder();
+		size_t victim = 17;
+		size_t o = p.original_index(victim);
+		p.remove_particle(victim);
+		p.add_particle(20., 20., 0., a);
+		p.finalize();
+
+		REQUIRE(p.original_index(p.size() - 1) == p.size() - 1);
+		auto & indices = p.original_indices();
+		vector<size_t> sorted(indices.begin(), indices.end());
+		sort(sorted.begin(), sorted.end());
+		for (size_t k=0; k < sorted.size(); k++)
+			REQUIRE(sorted[k] == k);
+
+		// every survivor that came after the removed particle moved down by one
+		for (size_t i=0; i + 1 < p.size(); i++) {
+			size_t before_index = p.original_index(i) >= o? p.original_index(i) + 1 : p.original_index(i);
+			REQUIRE(p.particle_arrays().x()[i] == before.x()[before_index]);
+		}
+	}
+}
+
+TEST_CASE("Vertical sweeps for force spectroscopy") {
+	LJPotential<double> p;
+	fill_slab(p, 10, 10, 3, 0.5, 1.2);
+	p.add_particle(4.4, 5.2, 0.9, 0.9, 1.6);
+
+	// compares a sweep against evaluate() at each height
+	auto check_sweep = [&] (double x, double y, double rel_tol) {
+		auto sweep = p.z_sweep(x, y, 1.5, 6., 19);
+		REQUIRE(sweep.z.size() == 19);
+		REQUIRE(sweep.z.front() == 1.5);
+		REQUIRE(sweep.z.back() == 6.);
+		REQUIRE(sweep.z[2] == Approx(2.));
+
+		for (size_t k=0; k < sweep.z.size(); k++) {
+			auto e = p.evaluate(x, y, sweep.z[k]);
+			REQUIRE(sweep.energy[k] == Approx(e.energy).epsilon(rel_tol));
+			REQUIRE(sweep.force_z[k] == Approx(e.force[2]).epsilon(rel_tol));
+		}
+	};
+
+	SECTION("Full sum") {
+		check_sweep(4.4, 5.2, 1E-12);
+		check_sweep(0.3, 7.7, 1E-12);
+	}
+
+	SECTION("Cutoff, with the tail correction") {
+		p.set_cutoff(3.);
+		check_sweep(4.4, 5.2, 1E-12);
+	}
+
+	SECTION("Periodic slab with cutoff") {
+		p.set_periodic({{10., 0., 0.}}, {{0., 10., 0.}}, {{0., 0., 40.}});
+		p.set_cutoff(3.5);
+		check_sweep(0.3, 7.7, 1E-12);
+	}
+
+	SECTION("Far-field mode") {
+		p.set_far_field(0.3);
+		check_sweep(4.4, 5.2, 1E-12);
+	}
+
+	SECTION("The force is minus the derivative of the energy") {
+		// (keeping the lattice of particles clear of the cutoff sphere)
+		p.set_cutoff(3.3);
+		vector<double> zs = {3., 2.2, 4.7};
+		auto sweep = p.z_sweep(4., 5., zs);
+		for (size_t k=0; k < zs.size(); k++) {
+			double x = 4., y = 5.;
+			auto energy = [&] (double z) { return p.value_at(x, y, z); };
+			REQUIRE(sweep.force_z[k] == Approx(-differentiate_5point(energy, zs[k], 1E-3)).epsilon(1E-6));
+		}
+	}
+
+	SECTION("Single heights and empty sweeps") {
+		auto one = p.z_sweep(4., 5., 2.5, 9., 1);
+		REQUIRE(one.z.size() == 1);
+		REQUIRE(one.energy[0] == Approx(p.value_at(4., 5., 2.5)).epsilon(1E-12));
+		REQUIRE(p.z_sweep(4., 5., 2.5, 9., 0).energy.empty());
+	}
+
+	SECTION("Unavailable with a custom pair function") {
+		p.set_cutoff(3.);
+		p.set_tabulation(64, [] (const LJParameters<double> &, double) { return 0.; });
+		REQUIRE_THROWS_AS(p.z_sweep(4., 5., 2., 3., 4), std::logic_error);
+	}
+}
+
+TEST_CASE("Evaluating several probes at once") {
+	LJPotential<double> p;
+	LJSpeciesIndex carbon = p.add_species(0.5, 1.2);
+	LJSpeciesIndex oxygen = p.add_species(0.7, 1.5);
+	for (int i=0; i<8; i++)
+		for (int j=0; j<8; j++)
+			p.add_particle(i, j, -(i + j) % 2 * 0.6, (i + j) % 3? carbon : oxygen);
+
+	LJSpeciesIndex co = p.add_species(0.3, 1.8);
+	LJSpeciesIndex xe = p.add_species(1.1, 2.2);
+	vector<LJSpeciesIndex> probes = {co, xe, carbon};
+
+	Lattice3<double> shape(7, 6, 5);
+	shape.set_lower_coords(0.5, 1., 1.5).set_upper_coords(6.5, 6., 4.);
+
+	// each lattice matches a separate evaluation with that probe selected
+	auto check_probes = [&] () {
+		vector<Lattice3<double>> lattices(probes.size(), shape);
+		evaluate_on_lattices(p, probes, lattices);
+
+		for (size_t k=0; k < probes.size(); k++) {
+			p.set_probe_species(probes[k]);
+			Lattice3<double> single = shape;
+			evaluate_on_lattice(p, single);
+			REQUIRE(lattices[k] == single);
+		}
+		p.clear_probe_species();
+	};
+
+	SECTION("Full sum")   { check_probes(); }
+	SECTION("Cutoff")     { p.set_cutoff(3.); check_probes(); }
+	SECTION("Periodic")   {
+		p.set_periodic({{8., 0., 0.}}, {{0., 8., 0.}}, {{0., 0., 30.}});
+		p.set_cutoff(3.5);
+		check_probes();
+	}
+
+	SECTION("Bad arguments") {
+		vector<Lattice3<double>> lattices(2, shape);
+		REQUIRE_THROWS_AS(evaluate_on_lattices(p, probes, lattices), std::invalid_argument);
+
+		lattices.push_back(Lattice3<double>(7, 6, 4));
+		REQUIRE_THROWS_AS(evaluate_on_lattices(p, probes, lattices), std::invalid_argument);
+
+		lattices.back() = shape;
+		p.set_far_field(0.3);
+		REQUIRE_THROWS_AS(evaluate_on_lattices(p, probes, lattices), std::logic_error);
+	}
+}
+
+TEST_CASE("Summation methods") {
+	SECTION("Accumulators") {
+		// terms that cancel, hiding small ones
+		vector<double> terms;
+		for (int i=0; i < 1000; i++) {
+			terms.push_back(1E16);
+			terms.push_back(1.);
+			terms.push_back(-1E16);
+		}
+
+		Accumulator<double> naive(SummationMethod::Naive), compensated(SummationMethod::Compensated);
+		for (double t : terms) {
+			naive.add(t);
+			compensated.add(t);
+		}
+		REQUIRE(compensated.result() == 1000.);
+		REQUIRE(naive.result() != 1000.);
+
+		// many equal terms, whose naive sum drifts
+		Accumulator<double> pairwise(SummationMethod::Pairwise), drifting(SummationMethod::Naive);
+		const int n = 1000003; // (not a multiple of the block size)
+		for (int i=0; i < n; i++) {
+			pairwise.add(0.1);
+			drifting.add(0.1);
+		}
+		double exact = 0.1L * n;
+		REQUIRE(fabs(pairwise.result() - exact) < fabs(drifting.result() - exact) / 100);
+		REQUIRE(pairwise.result() == Approx(exact).epsilon(1E-14));
+	}
+
+	LJPotential<double> p;
+	fill_slab(p, 9, 9, 3, 0.5, 1.2);
+	p.add_particle(4.1, 4.3, 0.8, 0.9, 1.6);
+
+	double x = 4.2, y = 3.9, z = 1.7;
+
+	// The terms summed in order on the scalar side, which is what the non-naive
+	//  methods promise to reproduce exactly, whatever the SIMD width
+	auto scalar_sum = [&] (SummationMethod method, double cutoff) {
+		auto & arrays = p.particle_arrays();
+		auto row = p.species_table().probe_row();
+		Accumulator<double> sum(method);
+		for (size_t i=0; i < arrays.size(); i++) {
+			LJSpeciesIndex s = arrays.species()[i];
+			double dx = x - arrays.x()[i], dy = y - arrays.y()[i], dz = z - arrays.z()[i];
+			double r2 = dx*dx + dy*dy + dz*dz;
+			if (cutoff == 0 || r2 < cutoff * cutoff)
+				sum.add(LJShape::term(row.energy_unit[s], row.length_unit_sq[s], r2));
+		}
+		return sum.result();
+	};
+
+	SECTION("Term by term sums are independent of the SIMD width") {
+		for (auto method : {SummationMethod::Compensated, SummationMethod::Pairwise}) {
+			p.set_summation(method);
+			REQUIRE(p.summation_method() == method);
+			REQUIRE(p.value_at(x, y, z) == scalar_sum(method, 0));
+		}
+	}
+
+	SECTION("All methods agree closely") {
+		double naive = p.value_at(x, y, z);
+		for (auto method : {SummationMethod::Compensated, SummationMethod::Pairwise}) {
+			p.set_summation(method);
+			REQUIRE(p.value_at(x, y, z) == Approx(naive).epsilon(1E-13));
+
+			p.set_cutoff(3.).set_tail_correction(false);
+			REQUIRE(p.value_at(x, y, z) == Approx(scalar_sum(method, 3.)).epsilon(1E-13));
+			p.clear_cutoff();
+		}
+	}
+
+	SECTION("Lattices, batches, and thread counts") {
+		Lattice3<double> lattice(5, 6, 4);
+		lattice.set_lower_coords(1., 1., 1.).set_upper_coords(7., 6., 3.);
+
+		for (auto method : {SummationMethod::Naive, SummationMethod::Compensated, SummationMethod::Pairwise}) {
+			p.set_summation(method);
+			p.set_cutoff(3.);
+			for (int pass=0; pass < 2; pass++) {
+				Lattice3<double> one = lattice, three = lattice;
+				evaluate_on_lattice(p, one, 1);
+				evaluate_on_lattice(p, three, 3);
+				REQUIRE(one == three);
+				REQUIRE(one(2, 3, 1) == Approx(p.value_at(4., 4., 1. + 2./3.)).epsilon(1E-13));
+
+				vector<double> xs = {4.2, 1.5}, ys = {3.9, 5.5}, zs = {1.7, 2.2}, out(2);
+				p.value_at_many(xs.data(), ys.data(), zs.data(), 2, out.data());
+				REQUIRE(out[1] == p.value_at(1.5, 5.5, 2.2));
+
+				// then without a cutoff
+				p.clear_cutoff();
+			}
+		}
+	}
+}
@@ -1,8 +1,45 @@
 #include "../external-deps/catch.hpp"
 
+#include <random>
+#include <array>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <cstdint>
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
 #include "../pseudopotential-lj.hpp"
 #include "../potential-lj.hpp"
 
+// Counts calls to operator new while `counting_allocations` is set.
+// (Eigen allocates through malloc instead; the tests are built with EIGEN_RUNTIME_NO_MALLOC,
+//  see the Makefile, so that a test can forbid that outright.)
+static std::atomic<bool> counting_allocations(false);
+static std::atomic<std::size_t> allocation_count(0);
+
+void * operator new (std::size_t size)
+{
+	if (counting_allocations)
+		allocation_count++;
+	void * p = std::malloc(size? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete (void * p) noexcept
+{
+	std::free(p);
+}
+
 template <typename R>
 void test_fit_to_lj (R & rng, std::array<size_t,3> dims, std::array<double,3> pos)
 {
@@ -43,6 +80,35 @@ void test_fit_to_lj (R & rng, std::array<size_t,3> dims, std::array<double,3> po
 	}
 }
 
+// (x, y, z, energy unit, length unit) of a particle
+typedef std::array<double, 5> SampleParticle;
+
+// The samples that the fit tests share: three particles at different heights, and the
+//  first two of them
+const std::vector<SampleParticle> THREE_PARTICLES = {{
+	{{0.2, 0.3,  0.0, 0.7, 0.23}},
+	{{0.7, 0.6,  0.1, 0.5, 0.25}},
+	{{0.5, 0.1, -0.1, 0.9, 0.2}},
+}};
+const std::vector<SampleParticle> TWO_PARTICLES(THREE_PARTICLES.begin(), THREE_PARTICLES.begin() + 2);
+
+// The potential of `particles` on a lattice of shape `dims`, spanning [lower, upper]
+//  (by default x and y in [0,1], and z in [0.5,0.9])
+Lattice3<double> sample_lattice (std::array<std::size_t, 3> dims, const std::vector<SampleParticle> & particles,
+                                 std::array<double, 3> lower = {{0., 0., 0.5}},
+                                 std::array<double, 3> upper = {{1., 1., 0.9}})
+{
+	LJPotential<double> lj;
+	for (auto & p : particles)
+		lj.add_particle(p[0], p[1], p[2], p[3], p[4]);
+
+	Lattice3<double> data(dims);
+	data.set_lower_coords(lower[0], lower[1], lower[2]);
+	data.set_upper_coords(upper[0], upper[1], upper[2]);
+	evaluate_on_lattice(lj, data);
+	return data;
+}
+
 TEST_CASE("pseudopotential-lj") {
 
 	unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
@@ -60,3 +126,419 @@ TEST_CASE("pseudopotential-lj") {
 		}
 	}
 }
+
+TEST_CASE("pseudopotential-lj parallel fit") {
+	// a few particles, so that the columns converge at different rates
+	auto data = sample_lattice({{9, 8, 25}}, THREE_PARTICLES);
+
+	auto serial = LJPseudoPotential<double>::fit_to_data(data, 1E-9, 1);
+	for (unsigned threads : {2u, 3u, 0u}) {
+		auto parallel = LJPseudoPotential<double>::fit_to_data(data, 1E-9, threads);
+		for (std::size_t i=0; i < data.size_0(); i++) {
+			for (std::size_t j=0; j < data.size_1(); j++) {
+				double x = data.coord_0(i), y = data.coord_1(j);
+				REQUIRE(parallel.value_at(x, y, 0.7) == serial.value_at(x, y, 0.7));
+				REQUIRE(parallel.force_z_derivative_at(x, y, 0.6) == serial.force_z_derivative_at(x, y, 0.6));
+			}
+		}
+	}
+}
+
+TEST_CASE("pseudopotential-lj seeded fits") {
+	auto data = sample_lattice({{10, 9, 25}}, THREE_PARTICLES);
+
+	SECTION("Seeded fits converge to the same parameters") {
+		// (a tolerance small next to the data, so that where each fit stops hardly matters)
+		auto fixed = LJPseudoPotential<double>::fit_to_data(data, 1E-13, 1);
+		for (LJFitSeeding seeding : {LJFitSeeding::Continuation, LJFitSeeding::Coarse}) {
+			auto seeded = LJPseudoPotential<double>::fit_to_data(data, 1E-13, 2, seeding);
+			for (std::size_t i=0; i < data.size_0(); i++) {
+				for (std::size_t j=0; j < data.size_1(); j++) {
+					double x = data.coord_0(i), y = data.coord_1(j);
+					REQUIRE(seeded.value_at(x, y, 0.7) == Approx(fixed.value_at(x, y, 0.7)).epsilon(1E-4));
+				}
+			}
+		}
+	}
+
+	SECTION("Coarse seeding does not depend on the thread count") {
+		auto serial = LJPseudoPotential<double>::fit_to_data(data, 1E-9, 1, LJFitSeeding::Coarse);
+		auto parallel = LJPseudoPotential<double>::fit_to_data(data, 1E-9, 3, LJFitSeeding::Coarse);
+		for (std::size_t i=0; i < data.size_0(); i++) {
+			for (std::size_t j=0; j < data.size_1(); j++) {
+				double x = data.coord_0(i), y = data.coord_1(j);
+				REQUIRE(parallel.value_at(x, y, 0.7) == serial.value_at(x, y, 0.7));
+			}
+		}
+	}
+
+	SECTION("Starting from a neighbor's solution saves iterations") {
+		LJFitWorkspace<double> workspace(data.size_2());
+		LJFitWorkspace<double>::ArrayType z(data.size_2());
+		for (std::size_t k=0; k < data.size_2(); k++)
+			z(k) = data.coord_2(k);
+
+		auto load_column = [&] (std::size_t i, std::size_t j) {
+			for (std::size_t k=0; k < data.size_2(); k++)
+				workspace.values(k) = data(i, j, k);
+		};
+
+		load_column(4, 4);
+		auto neighbor = workspace.fit(z);
+
+		load_column(4, 5);
+		workspace.fit(z);
+		std::size_t cold = workspace.iterations();
+		workspace.fit(z, neighbor);
+		std::size_t warm = workspace.iterations();
+		REQUIRE(warm < cold);
+
+		// a useless seed falls back to the default guess
+		double nan = std::numeric_limits<double>::quiet_NaN();
+		auto from_nan = workspace.fit(z, Eigen::Matrix<double, 3, 1>(nan, nan, nan));
+		REQUIRE(workspace.iterations() == cold);
+		REQUIRE(from_nan == workspace.fit(z));
+	}
+}
+
+TEST_CASE("pseudopotential-lj fit methods") {
+	auto data = sample_lattice({{11, 11, 25}}, THREE_PARTICLES);
+
+	auto options = LJFitOptions<double>().set_tolerance(1E-13).set_threads(2);
+
+	SECTION("The nonlinear methods agree") {
+		auto gauss_newton = LJPseudoPotential<double>::fit_to_data(data, options);
+		for (LJFitMethod method : {LJFitMethod::LevenbergMarquardt, LJFitMethod::Hybrid}) {
+			auto fit = LJPseudoPotential<double>::fit_to_data(data, options.set_method(method));
+			for (std::size_t i=0; i < data.size_0(); i++) {
+				for (std::size_t j=0; j < data.size_1(); j++) {
+					double x = data.coord_0(i), y = data.coord_1(j);
+					REQUIRE(fit.value_at(x, y, 0.7) == Approx(gauss_newton.value_at(x, y, 0.7)).epsilon(1E-4));
+				}
+			}
+		}
+	}
+
+	SECTION("Linear fits c6 and c12 exactly above a lone particle at z=0") {
+		LJPotential<double> single;
+		single.add_particle(0.2, 0.3, 0.0, 0.7, 0.23);
+		data = sample_lattice({{11, 11, 25}}, {THREE_PARTICLES[0]});
+
+		auto fit = LJPseudoPotential<double>::fit_to_data(data, options.set_method(LJFitMethod::Linear));
+		for (double z : {0.5, 0.63, 0.9})
+			REQUIRE(fit.value_at(0.2, 0.3, z) == Approx(single.value_at(0.2, 0.3, z)));
+	}
+
+	SECTION("Linear matches a least squares solve of each column on its own") {
+		auto fit = LJPseudoPotential<double>::fit_to_data(data, options.set_method(LJFitMethod::Linear));
+
+		Eigen::MatrixXd x(data.size_2(), 2);
+		for (std::size_t k=0; k < data.size_2(); k++) {
+			x(k, 0) = ipow<-6>(data.coord_2(k));
+			x(k, 1) = ipow<-12>(data.coord_2(k));
+		}
+		auto qr = x.colPivHouseholderQr();
+
+		for (std::size_t i=0; i < data.size_0(); i++) {
+			for (std::size_t j=0; j < data.size_1(); j++) {
+				Eigen::VectorXd column(data.size_2());
+				for (std::size_t k=0; k < data.size_2(); k++)
+					column(k) = data(i, j, k);
+				Eigen::VectorXd expected = qr.solve(column);
+
+				REQUIRE(fit.z0(i, j) == 0.);
+				REQUIRE(fit.coeff6(i, j) == Approx(expected(0)).epsilon(1E-10));
+				REQUIRE(fit.coeff12(i, j) == Approx(expected(1)).epsilon(1E-10));
+			}
+		}
+	}
+
+	SECTION("The workspace has nothing to iterate for a linear fit") {
+		REQUIRE_THROWS_AS(LJFitWorkspace<double>(25, LJFitOptions<double>().set_method(LJFitMethod::Linear)), std::invalid_argument);
+	}
+}
+
+TEST_CASE("pseudopotential-lj fit diagnostics") {
+	auto data = sample_lattice({{8, 7, 25}}, THREE_PARTICLES);
+	std::size_t ncols = data.size_0() * data.size_1();
+
+	auto options = LJFitOptions<double>().set_tolerance(1E-13);
+	LJFitDiagnostics<double> diagnostics;
+
+	SECTION("Every column is accounted for") {
+		for (LJFitMethod method : {LJFitMethod::GaussNewton, LJFitMethod::LevenbergMarquardt, LJFitMethod::Hybrid}) {
+			LJPseudoPotential<double>::fit_to_data(data, options.set_method(method), diagnostics);
+			REQUIRE(diagnostics.iterations.size_0() == data.size_0());
+			REQUIRE(diagnostics.iterations.size_1() == data.size_1());
+			std::size_t finished = diagnostics.count(LJFitStatus::Converged) + diagnostics.count(LJFitStatus::Stalled);
+			REQUIRE(finished == ncols);
+			REQUIRE(diagnostics.mean_iterations() >= 1);
+
+			for (std::size_t i=0; i < data.size_0(); i++) {
+				for (std::size_t j=0; j < data.size_1(); j++) {
+					double data_sqsum = 0;
+					for (std::size_t k=0; k < data.size_2(); k++)
+						data_sqsum += data(i, j, k) * data(i, j, k);
+					REQUIRE(diagnostics.residual(i, j) < 1E-3 * data_sqsum);
+				}
+			}
+		}
+
+		LJPseudoPotential<double>::fit_to_data(data, options.set_method(LJFitMethod::Linear), diagnostics);
+		REQUIRE(diagnostics.count(LJFitStatus::Direct) == ncols);
+		REQUIRE(diagnostics.mean_iterations() == 0);
+	}
+
+	SECTION("Fits stop at the iteration limit") {
+		for (LJFitMethod method : {LJFitMethod::GaussNewton, LJFitMethod::LevenbergMarquardt}) {
+			LJPseudoPotential<double>::fit_to_data(data, options.set_method(method).set_max_iterations(2), diagnostics);
+			REQUIRE(diagnostics.count(LJFitStatus::IterationLimit) == ncols);
+			for (std::size_t i=0; i < data.size_0(); i++)
+				for (std::size_t j=0; j < data.size_1(); j++)
+					REQUIRE(diagnostics.iterations(i, j) == 2);
+		}
+	}
+
+	SECTION("A relative tolerance stops fits sooner") {
+		LJPseudoPotential<double>::fit_to_data(data, options, diagnostics);
+		double strict = diagnostics.mean_iterations();
+		LJPseudoPotential<double>::fit_to_data(data, options.set_relative_tolerance(1E-2), diagnostics);
+		REQUIRE(diagnostics.mean_iterations() < strict);
+		REQUIRE(diagnostics.count(LJFitStatus::Converged) == ncols);
+	}
+}
+
+TEST_CASE("pseudopotential-lj interpolation") {
+	auto fit_grid = [] (std::size_t n) {
+		return LJPseudoPotential<double>::fit_to_data(sample_lattice({{n, n, 25}}, THREE_PARTICLES), 1E-13);
+	};
+
+	auto coarse = fit_grid(9);
+	auto coarse_nearest = coarse;
+	coarse_nearest.set_interpolation(LJInterpolation::Nearest);
+	auto dense = fit_grid(33);
+	dense.set_interpolation(LJInterpolation::Nearest);
+	REQUIRE(coarse.interpolation() == LJInterpolation::Bicubic);
+
+	SECTION("Bicubic patches pass through the fitted points") {
+		for (std::size_t i=0; i < 9; i++) {
+			for (std::size_t j=0; j < 9; j++) {
+				double x = i / 8., y = j / 8.;
+				double bicubic = coarse.value_at(x, y, 0.7);
+				double nearest = coarse_nearest.value_at(x, y, 0.7);
+				REQUIRE(bicubic == Approx(nearest));
+			}
+		}
+	}
+
+	SECTION("Bicubic follows a finer fit much more closely than nearest neighbor") {
+		double nearest_error = 0, bicubic_error = 0;
+		for (std::size_t i=0; i < 33; i++) {
+			for (std::size_t j=0; j < 33; j++) {
+				double x = i / 32., y = j / 32.;
+				double expected = dense.value_at(x, y, 0.7);
+				bicubic_error = std::max(bicubic_error, std::fabs(coarse.value_at(x, y, 0.7) - expected));
+				nearest_error = std::max(nearest_error, std::fabs(coarse_nearest.value_at(x, y, 0.7) - expected));
+			}
+		}
+		REQUIRE(bicubic_error < nearest_error / 10);
+	}
+
+	SECTION("Points off the lattice take the parameters of its edge") {
+		REQUIRE(coarse.value_at(-0.5, 0.3, 0.7) == coarse.value_at(0., 0.3, 0.7));
+		REQUIRE(coarse.value_at(0.4, 1.5, 0.7) == coarse.value_at(0.4, 1., 0.7));
+		REQUIRE(coarse.force_z_derivative_at(2., -1., 0.7) == coarse.force_z_derivative_at(1., 0., 0.7));
+	}
+
+	SECTION("Each point's parameters lead its record, which starts a cache line") {
+		for (std::size_t i=0; i < 9; i++) {
+			for (std::size_t j=0; j < 9; j++) {
+				for (auto * fit : {&coarse, &coarse_nearest}) {
+					const double * r = fit->record(i, j);
+					REQUIRE(r[0] == fit->z0(i, j));
+					REQUIRE(r[1] == fit->coeff6(i, j));
+					REQUIRE(r[2] == fit->coeff12(i, j));
+				}
+				std::size_t offset = reinterpret_cast<std::uintptr_t>(coarse.record(i, j)) % 64;
+				REQUIRE(offset == 0);
+			}
+		}
+	}
+}
+
+TEST_CASE("pseudopotential-lj rendering") {
+	auto data = sample_lattice({{9, 11, 25}}, TWO_PARTICLES);
+	auto bicubic = LJPseudoPotential<double>::fit_to_data(data, 1E-13);
+	auto nearest = bicubic;
+	nearest.set_interpolation(LJInterpolation::Nearest);
+
+	// (reaching off the fit's lattice, with rows that are no multiple of the SIMD width)
+	auto image = Lattice2<double>(23, 37)
+		.set_lower_coords(-0.1, -0.2)
+		.set_upper_coords(1.1, 1.05)
+	;
+
+	SECTION("Planes match value_at") {
+		for (auto * fit : {&bicubic, &nearest}) {
+			fit->render_plane(0.7, image, 1);
+			for (std::size_t i=0; i < image.size_0(); i++)
+				for (std::size_t j=0; j < image.size_1(); j++)
+					REQUIRE(image(i, j) == fit->value_at(image.coord_0(i), image.coord_1(j), 0.7));
+		}
+	}
+
+	SECTION("Planes do not depend on the thread count") {
+		auto threaded = image;
+		bicubic.render_plane(0.6, image, 1);
+		bicubic.render_plane(0.6, threaded, 3);
+		for (std::size_t i=0; i < image.size_0(); i++)
+			for (std::size_t j=0; j < image.size_1(); j++)
+				REQUIRE(image(i, j) == threaded(i, j));
+	}
+
+	SECTION("Volumes match their planes") {
+		auto volume = Lattice3<double>(23, 37, 7)
+			.set_lower_coords(-0.1, -0.2, 0.55)
+			.set_upper_coords(1.1, 1.05, 0.85)
+		;
+		bicubic.render_volume(volume, 2);
+		for (std::size_t k=0; k < volume.size_2(); k++) {
+			bicubic.render_plane(volume.coord_2(k), image);
+			for (std::size_t i=0; i < image.size_0(); i++)
+				for (std::size_t j=0; j < image.size_1(); j++)
+					REQUIRE(volume(i, j, k) == image(i, j));
+		}
+	}
+}
+
+TEST_CASE("pseudopotential-lj files") {
+	auto data = sample_lattice({{7, 10, 25}}, TWO_PARTICLES, {{-0.5, 0.1, 0.5}}, {{1.5, 0.8, 0.9}});
+	auto bicubic = LJPseudoPotential<double>::fit_to_data(data, 1E-13);
+	auto nearest = bicubic;
+	nearest.set_interpolation(LJInterpolation::Nearest);
+
+	std::string path = "/tmp/test-pseudopotential-lj-" + std::to_string(getpid()) + ".bin";
+	auto write_bytes = [&] (const std::string & bytes) {
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		out << bytes;
+	};
+
+	SECTION("Mapped files hold the very same records") {
+		for (auto * fit : {&bicubic, &nearest}) {
+			fit->save(path);
+			auto mapped = LJPseudoPotential<double>::open_mapped(path);
+			REQUIRE(mapped.is_mapped());
+			REQUIRE(mapped.interpolation() == fit->interpolation());
+			REQUIRE(mapped.size_0() == fit->size_0());
+			REQUIRE(mapped.size_1() == fit->size_1());
+			REQUIRE(mapped.coord_1(9) == fit->coord_1(9));
+
+			std::size_t offset = reinterpret_cast<std::uintptr_t>(mapped.record(0, 0)) % 64;
+			REQUIRE(offset == 0);
+			for (std::size_t i=0; i < fit->size_0(); i++) {
+				for (std::size_t j=0; j < fit->size_1(); j++) {
+					const double * a = fit->record(i, j);
+					const double * b = mapped.record(i, j);
+					REQUIRE(std::equal(a, a + fit->record_size(), b));
+				}
+			}
+
+			for (double x=-0.6; x < 1.6; x += 0.13)
+				for (double y=0.; y < 0.9; y += 0.07)
+					REQUIRE(mapped.value_at(x, y, 0.7) == fit->value_at(x, y, 0.7));
+		}
+	}
+
+	SECTION("A mapped pseudopotential can still change interpolation") {
+		bicubic.save(path);
+		auto mapped = LJPseudoPotential<double>::open_mapped(path);
+		auto copy = mapped;
+		mapped.set_interpolation(LJInterpolation::Nearest);
+		REQUIRE(!mapped.is_mapped());
+		REQUIRE(copy.is_mapped());
+		for (std::size_t i=0; i < nearest.size_0(); i++)
+			for (std::size_t j=0; j < nearest.size_1(); j++)
+				REQUIRE(mapped.coeff12(i, j) == nearest.coeff12(i, j));
+	}
+
+	SECTION("Every axis needs at least 2 points") {
+		REQUIRE_THROWS_AS(LJPseudoPotential<double>(1, 5), std::invalid_argument);
+		REQUIRE_THROWS_AS(LJPseudoPotential<double>(5, 0), std::invalid_argument);
+	}
+
+	SECTION("Files that are not pseudopotentials are refused") {
+		REQUIRE_THROWS_AS(LJPseudoPotential<double>::open_mapped(path + ".missing"), MappedFile::Error);
+
+		write_bytes("LJPSEUDO, but too short");
+		REQUIRE_THROWS_AS(LJPseudoPotential<double>::open_mapped(path), LJPseudoPotentialFileError);
+
+		bicubic.save(path);
+		std::string bytes;
+		{
+			std::ifstream in(path, std::ios::binary);
+			bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		}
+
+		write_bytes(bytes.substr(0, bytes.size() - 1));
+		REQUIRE_THROWS_AS(LJPseudoPotential<double>::open_mapped(path), LJPseudoPotentialFileError);
+
+		REQUIRE_THROWS_AS(LJPseudoPotential<float>::open_mapped(path), LJPseudoPotentialFileError);
+
+		for (std::uint64_t size : {0, 1}) {
+			std::string flat = bytes;
+			std::memcpy(&flat[offsetof(LJPseudoPotentialFileHeader, dims) + sizeof size], &size, sizeof size);
+			write_bytes(flat);
+			REQUIRE_THROWS_AS(LJPseudoPotential<double>::open_mapped(path), LJPseudoPotentialFileError);
+		}
+
+		bytes[8] = char(LJ_FILE_VERSION + 1);
+		write_bytes(bytes);
+		REQUIRE_THROWS_AS(LJPseudoPotential<double>::open_mapped(path), LJPseudoPotentialFileError);
+	}
+
+	std::remove(path.c_str());
+}
+
+TEST_CASE("pseudopotential-lj fit workspace does not allocate") {
+	auto data = sample_lattice({{4, 4, 25}}, TWO_PARTICLES);
+
+	LJFitWorkspace<double> workspace(data.size_2());
+	LJFitWorkspace<double>::ArrayType z(data.size_2());
+	for (std::size_t k=0; k < data.size_2(); k++)
+		z(k) = data.coord_2(k);
+
+	auto fit_column = [&] (std::size_t i, std::size_t j) {
+		for (std::size_t k=0; k < data.size_2(); k++)
+			workspace.values(k) = data(i, j, k);
+		return workspace.fit(z);
+	};
+
+	for (LJFitMethod method : {LJFitMethod::GaussNewton, LJFitMethod::LevenbergMarquardt}) {
+		workspace = LJFitWorkspace<double>(data.size_2(), LJFitOptions<double>().set_method(method));
+
+		// (any lazily allocated state gets allocated here)
+		fit_column(0, 0);
+
+		std::size_t before = allocation_count;
+		counting_allocations = true;
+		Eigen::internal::set_is_malloc_allowed(false);
+		Eigen::Matrix<double, 3, 1> sum = Eigen::Matrix<double, 3, 1>::Zero();
+		for (std::size_t i=0; i < data.size_0(); i++)
+			for (std::size_t j=0; j < data.size_1(); j++)
+				sum += fit_column(i, j);
+		Eigen::internal::set_is_malloc_allowed(true);
+		counting_allocations = false;
+		std::size_t allocations = allocation_count - before;
+
+		REQUIRE(allocations == 0);
+		REQUIRE(std::isfinite(sum.sum()));
+	}
+	workspace = LJFitWorkspace<double>(data.size_2());
+
+	// and the workspace fits just as fit_to_data does
+	auto fit = LJPseudoPotential<double>::fit_to_data(data, 1E-9, 1);
+	fit.set_interpolation(LJInterpolation::Nearest);
+	auto column = fit_column(2, 1);
+	double x = data.coord_0(2), y = data.coord_1(1);
+	REQUIRE(fit.value_at(x, y, 0.7) == column(1) * ipow<-6>(0.7 - column(0)) + column(2) * ipow<-12>(0.7 - column(0)));
+}
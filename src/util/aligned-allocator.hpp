@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// A minimal std::allocator replacement which hands out memory aligned to `Align` bytes.
+// Used for the structure-of-arrays storage in the potentials, so that SIMD kernels
+//  may stream through the arrays without straddling cache lines.
+//
+// (std::aligned_alloc is C++17, and posix_memalign is... well, POSIX.  So we over-allocate
+//  with malloc and stash the original pointer just before the aligned block.)
+template <class T, std::size_t Align = 64>
+class AlignedAllocator {
+	static_assert((Align & (Align-1)) == 0, "alignment must be a power of two");
+	static_assert(Align >= sizeof(void*), "alignment must be able to hold a pointer");
+
+	public:
+		typedef T           value_type;
+		typedef T *         pointer;
+		typedef const T *   const_pointer;
+		typedef T &         reference;
+		typedef const T &   const_reference;
+		typedef std::size_t size_type;
+		typedef std::ptrdiff_t difference_type;
+
+		// allocator_traits can't rebind through the non-type parameter on its own
+		template <class U>
+		struct rebind { typedef AlignedAllocator<U, Align> other; };
+
+		AlignedAllocator () { }
+
+		template <class U>
+		AlignedAllocator (const AlignedAllocator<U, Align> &) { }
+
+		T * allocate (std::size_t n) {
+			if (n > std::size_t(-1) / sizeof(T) - Align)
+				throw std::bad_alloc();
+
+			void * raw = std::malloc(n * sizeof(T) + Align);
+			if (!raw)
+				throw std::bad_alloc();
+
+			// Leave at least one pointer's worth of room below the aligned block
+			std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*);
+			addr = (addr + Align - 1) & ~std::uintptr_t(Align - 1);
+
+			void ** aligned = reinterpret_cast<void**>(addr);
+			aligned[-1] = raw;
+			return reinterpret_cast<T*>(aligned);
+		}
+
+		void deallocate (T * p, std::size_t) {
+			if (p)
+				std::free(reinterpret_cast<void**>(p)[-1]);
+		}
+};
+
+template <class T, class U, std::size_t Align>
+bool operator== (const AlignedAllocator<T, Align> &, const AlignedAllocator<U, Align> &) { return true; }
+
+template <class T, class U, std::size_t Align>
+bool operator!= (const AlignedAllocator<T, Align> &, const AlignedAllocator<U, Align> &) { return false; }
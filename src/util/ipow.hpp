@@ -0,0 +1,45 @@
+#pragma once
+
+// Integer powers with the exponent fixed at compile time, expanded into a chain of
+//  multiplications by repeated squaring (so x^12 costs 4 multiplies, and no call to pow).
+// Works for any T with operator* (and operator/ for negative exponents), including the
+//  SIMD types of util/simd.hpp.
+//
+//   ipow<N>(x)              x^N
+//   half_ipow<K>(sq, root)  root^K, given sq = root^2  (root is only used when K is odd)
+
+template <int N, bool Odd = (N % 2 == 1)>
+struct IntegerPower {
+	template <class T> static T of (T x) { return IntegerPower<N / 2>::of(x * x); }
+};
+
+template <int N>
+struct IntegerPower<N, true> {
+	template <class T> static T of (T x) { return x * IntegerPower<N - 1>::of(x); }
+};
+
+template <> struct IntegerPower<0, false> { template <class T> static T of (T)   { return T(1); } };
+template <> struct IntegerPower<1, true>  { template <class T> static T of (T x) { return x; } };
+
+template <int N, bool Negative = (N < 0)>
+struct SignedPower {
+	template <class T> static T of (T x) { return IntegerPower<N>::of(x); }
+};
+
+template <int N>
+struct SignedPower<N, true> {
+	template <class T> static T of (T x) { return T(1) / IntegerPower<-N>::of(x); }
+};
+
+template <int N, class T>
+inline T ipow (T x)
+{
+	return SignedPower<N>::of(x);
+}
+
+template <int K, class T>
+inline T half_ipow (T sq, T root)
+{
+	// ((K - 1) / 2 rounds towards zero, which is exact for odd K of either sign)
+	return (K % 2 == 0)? ipow<K / 2>(sq) : ipow<(K - 1) / 2>(sq) * root;
+}
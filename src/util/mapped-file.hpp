@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// A whole file mapped read-only into memory (POSIX mmap).
+// The pages are shared with every other process mapping the same file, and are only read
+//  from disk as they are first touched.  The mapping starts on a page boundary, so data
+//  at an aligned offset in the file is equally aligned in memory.
+class MappedFile {
+	public:
+		struct Error : public std::runtime_error {
+			template <class... Args>
+			Error(Args&&... args)
+			: std::runtime_error(std::forward<Args>(args)...)
+			{ }
+		};
+
+		explicit MappedFile (const std::string & path)
+		{
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+				throw Error(path + ": " + std::strerror(errno));
+
+			struct stat info;
+			if (::fstat(fd, &info) != 0) {
+				int code = errno;
+				::close(fd);
+				throw Error(path + ": " + std::strerror(code));
+			}
+
+			_size = std::size_t(info.st_size);
+			if (_size > 0) {
+				void * p = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+				if (p == MAP_FAILED) {
+					int code = errno;
+					::close(fd);
+					throw Error(path + ": " + std::strerror(code));
+				}
+				_data = static_cast<const char *>(p);
+			}
+
+			// (the mapping outlives the descriptor)
+			::close(fd);
+		}
+
+		~MappedFile ()
+		{
+			if (_data)
+				::munmap(const_cast<char *>(_data), _size);
+		}
+
+		MappedFile (const MappedFile &) = delete;
+		MappedFile & operator= (const MappedFile &) = delete;
+
+		const char * data () const { return _data; }
+		std::size_t size () const { return _size; }
+
+	private:
+		const char * _data = nullptr;
+		std::size_t _size = 0;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <algorithm>
+#include <cstddef>
+
+// Resolves a requested thread count, where 0 means "one per hardware thread".
+inline unsigned resolve_thread_count (unsigned requested)
+{
+	if (requested != 0)
+		return requested;
+	unsigned hw = std::thread::hardware_concurrency();
+	return hw ? hw : 1;
+}
+
+// Calls f(state, i) for every i in [0, n), spread over `threads` threads (0 = all hardware
+//  threads), where each participating thread first creates its own `state` by calling
+//  make_state().  This lets scratch buffers be allocated once per thread and then reused
+//  for every index the thread handles.
+//
+// Indices are handed out dynamically in chunks of `chunk` from a shared counter, so a thread
+//  that finishes its chunk early just grabs the next one; this keeps the load balanced when
+//  the cost per index varies.  The caller's thread takes part in the work.
+//
+// f must be safe to call concurrently for distinct indices.  If any call throws, the
+//  remaining chunks are abandoned and the first exception is rethrown here.
+template <class MakeState, class F>
+void parallel_for_with_state (std::size_t n, unsigned threads, MakeState && make_state, F && f, std::size_t chunk=1)
+{
+	threads = resolve_thread_count(threads);
+	chunk = std::max<std::size_t>(chunk, 1);
+
+	if (threads == 1 || n <= chunk) {
+		if (n == 0)
+			return;
+		auto state = make_state();
+		for (std::size_t i=0; i < n; i++)
+			f(state, i);
+		return;
+	}
+
+	std::atomic<std::size_t> next(0);
+	std::atomic<bool> failed(false);
+	std::exception_ptr error;
+	std::atomic_flag error_lock = ATOMIC_FLAG_INIT;
+
+	auto work = [&] () {
+		try {
+			auto state = make_state();
+			while (!failed) {
+				std::size_t begin = next.fetch_add(chunk);
+				if (begin >= n)
+					break;
+
+				std::size_t end = std::min(begin + chunk, n);
+				for (std::size_t i=begin; i < end; i++)
+					f(state, i);
+			}
+		} catch (...) {
+			if (!error_lock.test_and_set())
+				error = std::current_exception();
+			failed = true;
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned t=1; t < threads; t++)
+		pool.emplace_back(work);
+	work();
+	for (auto & thread : pool)
+		thread.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+// Calls f(i) for every i in [0, n); parallel_for_with_state without the state.
+template <class F>
+void parallel_for (std::size_t n, unsigned threads, F && f, std::size_t chunk=1)
+{
+	parallel_for_with_state(n, threads, [] () { return 0; }, [&] (int, std::size_t i) { f(i); }, chunk);
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX512F__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Thin wrappers around SIMD registers, giving them the arithmetic operators of a scalar.
+// This lets a numerical kernel be written once as a template over the vector type V and then
+//  instantiated for whatever instruction set the build enables (plus the scalar fallback,
+//  which doubles as the reference implementation).
+//
+// Every type provides:
+//   V::scalar, V::width
+//   V(scalar)                       broadcast
+//   V::load(const scalar *)         unaligned load of `width` elements
+//   V::gather(table, index)         table[index[k]] for each lane k  (16-bit indices)
+//   V::gather_at(table, v)          table[v[k]] for a vector v of whole numbers (< 2^31)
+//   V::zero()
+//   + - * /  sqrt(v)                elementwise; exactly one IEEE operation each
+//   min(a, b)  max(a, b)  trunc(v)  elementwise (trunc rounds towards zero)
+//   select_less(a, b, x)            x where a < b, else 0
+//   v.sum()                         lanes added left to right (a fixed order, for determinism)
+//   v.store(scalar *)
+
+template <class T>
+struct SimdScalar {
+	typedef T scalar;
+	static const std::size_t width = 1;
+
+	T v;
+
+	SimdScalar () { }
+	SimdScalar (T x) : v(x) { }
+
+	static SimdScalar load (const T * p) { return SimdScalar(*p); }
+	static SimdScalar gather (const T * table, const std::uint16_t * index) { return SimdScalar(table[*index]); }
+	static SimdScalar gather_at (const T * table, SimdScalar index) { return SimdScalar(table[std::size_t(index.v)]); }
+	static SimdScalar zero () { return SimdScalar(T(0)); }
+
+	void store (T * p) const { *p = v; }
+	T sum () const { return v; }
+
+	friend SimdScalar operator+ (SimdScalar a, SimdScalar b) { return SimdScalar(a.v + b.v); }
+	friend SimdScalar operator- (SimdScalar a, SimdScalar b) { return SimdScalar(a.v - b.v); }
+	friend SimdScalar operator* (SimdScalar a, SimdScalar b) { return SimdScalar(a.v * b.v); }
+	friend SimdScalar operator/ (SimdScalar a, SimdScalar b) { return SimdScalar(a.v / b.v); }
+	friend SimdScalar sqrt (SimdScalar a) { return SimdScalar(std::sqrt(a.v)); }
+	friend SimdScalar trunc (SimdScalar a) { return SimdScalar(std::trunc(a.v)); }
+	friend SimdScalar min (SimdScalar a, SimdScalar b) { return SimdScalar(b.v < a.v ? b.v : a.v); }
+	friend SimdScalar max (SimdScalar a, SimdScalar b) { return SimdScalar(a.v < b.v ? b.v : a.v); }
+
+	friend SimdScalar select_less (SimdScalar a, SimdScalar b, SimdScalar x) {
+		return SimdScalar(a.v < b.v ? x.v : T(0));
+	}
+};
+
+#if defined(__AVX512F__)
+
+struct SimdDouble8 {
+	typedef double scalar;
+	static const std::size_t width = 8;
+
+	__m512d v;
+
+	SimdDouble8 () { }
+	SimdDouble8 (double x) : v(_mm512_set1_pd(x)) { }
+	SimdDouble8 (__m512d x) : v(x) { }
+
+	static SimdDouble8 load (const double * p) { return _mm512_loadu_pd(p); }
+
+	static SimdDouble8 gather (const double * table, const std::uint16_t * index) {
+		__m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(index)));
+		return _mm512_i32gather_pd(wide, table, sizeof(double));
+	}
+
+	static SimdDouble8 gather_at (const double * table, SimdDouble8 index) {
+		return _mm512_i32gather_pd(_mm512_cvttpd_epi32(index.v), table, sizeof(double));
+	}
+
+	static SimdDouble8 zero () { return _mm512_setzero_pd(); }
+
+	void store (double * p) const { _mm512_storeu_pd(p, v); }
+
+	double sum () const {
+		alignas(64) double lanes[width];
+		_mm512_store_pd(lanes, v);
+		double result = 0;
+		for (std::size_t k=0; k < width; k++)
+			result += lanes[k];
+		return result;
+	}
+
+	friend SimdDouble8 operator+ (SimdDouble8 a, SimdDouble8 b) { return _mm512_add_pd(a.v, b.v); }
+	friend SimdDouble8 operator- (SimdDouble8 a, SimdDouble8 b) { return _mm512_sub_pd(a.v, b.v); }
+	friend SimdDouble8 operator* (SimdDouble8 a, SimdDouble8 b) { return _mm512_mul_pd(a.v, b.v); }
+	friend SimdDouble8 operator/ (SimdDouble8 a, SimdDouble8 b) { return _mm512_div_pd(a.v, b.v); }
+	friend SimdDouble8 sqrt (SimdDouble8 a) { return _mm512_sqrt_pd(a.v); }
+	friend SimdDouble8 trunc (SimdDouble8 a) { return _mm512_roundscale_pd(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+	friend SimdDouble8 min (SimdDouble8 a, SimdDouble8 b) { return _mm512_min_pd(a.v, b.v); }
+	friend SimdDouble8 max (SimdDouble8 a, SimdDouble8 b) { return _mm512_max_pd(a.v, b.v); }
+
+	friend SimdDouble8 select_less (SimdDouble8 a, SimdDouble8 b, SimdDouble8 x) {
+		return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(a.v, b.v, _CMP_LT_OQ), x.v);
+	}
+};
+
+#endif
+
+#if defined(__AVX__)
+
+struct SimdDouble4 {
+	typedef double scalar;
+	static const std::size_t width = 4;
+
+	__m256d v;
+
+	SimdDouble4 () { }
+	SimdDouble4 (double x) : v(_mm256_set1_pd(x)) { }
+	SimdDouble4 (__m256d x) : v(x) { }
+
+	static SimdDouble4 load (const double * p) { return _mm256_loadu_pd(p); }
+
+	static SimdDouble4 gather (const double * table, const std::uint16_t * index) {
+#if defined(__AVX2__)
+		__m128i wide = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(index)));
+		return _mm256_i32gather_pd(table, wide, sizeof(double));
+#else
+		return _mm256_set_pd(table[index[3]], table[index[2]], table[index[1]], table[index[0]]);
+#endif
+	}
+
+	static SimdDouble4 gather_at (const double * table, SimdDouble4 index) {
+		__m128i narrow = _mm256_cvttpd_epi32(index.v);
+#if defined(__AVX2__)
+		return _mm256_i32gather_pd(table, narrow, sizeof(double));
+#else
+		alignas(16) std::int32_t lanes[width];
+		_mm_store_si128(reinterpret_cast<__m128i *>(lanes), narrow);
+		return _mm256_set_pd(table[lanes[3]], table[lanes[2]], table[lanes[1]], table[lanes[0]]);
+#endif
+	}
+
+	static SimdDouble4 zero () { return _mm256_setzero_pd(); }
+
+	void store (double * p) const { _mm256_storeu_pd(p, v); }
+
+	double sum () const {
+		alignas(32) double lanes[width];
+		_mm256_store_pd(lanes, v);
+		double result = 0;
+		for (std::size_t k=0; k < width; k++)
+			result += lanes[k];
+		return result;
+	}
+
+	friend SimdDouble4 operator+ (SimdDouble4 a, SimdDouble4 b) { return _mm256_add_pd(a.v, b.v); }
+	friend SimdDouble4 operator- (SimdDouble4 a, SimdDouble4 b) { return _mm256_sub_pd(a.v, b.v); }
+	friend SimdDouble4 operator* (SimdDouble4 a, SimdDouble4 b) { return _mm256_mul_pd(a.v, b.v); }
+	friend SimdDouble4 operator/ (SimdDouble4 a, SimdDouble4 b) { return _mm256_div_pd(a.v, b.v); }
+	friend SimdDouble4 sqrt (SimdDouble4 a) { return _mm256_sqrt_pd(a.v); }
+	friend SimdDouble4 trunc (SimdDouble4 a) { return _mm256_round_pd(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+	friend SimdDouble4 min (SimdDouble4 a, SimdDouble4 b) { return _mm256_min_pd(a.v, b.v); }
+	friend SimdDouble4 max (SimdDouble4 a, SimdDouble4 b) { return _mm256_max_pd(a.v, b.v); }
+
+	friend SimdDouble4 select_less (SimdDouble4 a, SimdDouble4 b, SimdDouble4 x) {
+		return _mm256_and_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ), x.v);
+	}
+};
+
+#endif
+
+// The widest vector type this build supports for T.
+template <class T>
+struct SimdBest { typedef SimdScalar<T> type; };
+
+#if defined(__AVX512F__)
+template <> struct SimdBest<double> { typedef SimdDouble8 type; };
+#elif defined(__AVX__)
+template <> struct SimdBest<double> { typedef SimdDouble4 type; };
+#endif
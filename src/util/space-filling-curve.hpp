@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+
+// Keys along space-filling curves through a 3D grid of 2^21 cells per axis.
+// Sorting points by key places points that are close in space close together in the
+//  order, which is what makes a sorted array cache-friendly to walk through spatially.
+//
+// Coordinates are cell indices in [0, 2^21); higher bits are ignored.
+
+const int CURVE_BITS = 21;
+
+// Spreads the low 21 bits of v out to every third bit
+inline std::uint64_t spread_bits_3 (std::uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffULL;
+	v = (v | v << 16) & 0x1f0000ff0000ffULL;
+	v = (v | v <<  8) & 0x100f00f00f00f00fULL;
+	v = (v | v <<  4) & 0x10c30c30c30c30c3ULL;
+	v = (v | v <<  2) & 0x1249249249249249ULL;
+	return v;
+}
+
+// Z-order: the bits of the three indices interleaved, x most significant
+inline std::uint64_t morton_key (std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+	return spread_bits_3(x) << 2 | spread_bits_3(y) << 1 | spread_bits_3(z);
+}
+
+// Hilbert order, which unlike Z-order never jumps: consecutive cells along the curve are
+//  always face neighbors.
+// (Skilling's transform, "Programming the Hilbert curve", AIP Conf. Proc. 707 (2004),
+//  turns the indices into a form whose interleaved bits are the Hilbert index.)
+inline std::uint64_t hilbert_key (std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+	const std::uint32_t top = std::uint32_t(1) << (CURVE_BITS - 1);
+	std::uint32_t c[3] = { x & 0x1fffff, y & 0x1fffff, z & 0x1fffff };
+
+	// inverse undo
+	for (std::uint32_t q = top; q > 1; q >>= 1) {
+		std::uint32_t p = q - 1;
+		for (int i=0; i<3; i++) {
+			if (c[i] & q) {
+				c[0] ^= p;
+			} else {
+				std::uint32_t t = (c[0] ^ c[i]) & p;
+				c[0] ^= t;
+				c[i] ^= t;
+			}
+		}
+	}
+
+	// Gray encode
+	c[1] ^= c[0];
+	c[2] ^= c[1];
+	std::uint32_t t = 0;
+	for (std::uint32_t q = top; q > 1; q >>= 1)
+		if (c[2] & q)
+			t ^= q - 1;
+	for (int i=0; i<3; i++)
+		c[i] ^= t;
+
+	return morton_key(c[0], c[1], c[2]);
+}
+
+enum class SpaceFillingCurve { Hilbert, Morton };
+
+inline std::uint64_t curve_key (SpaceFillingCurve curve, std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+	return (curve == SpaceFillingCurve::Hilbert)? hilbert_key(x, y, z) : morton_key(x, y, z);
+}
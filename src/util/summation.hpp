@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <array>
+
+// Strategies for adding up long sequences of floating point terms.
+//
+//   Naive        one running sum.  The error grows as O(n eps) (times the sum of |term|).
+//   Compensated  Neumaier's variant of Kahan summation, which carries the rounding error
+//                 of each addition along separately.  The error is O(eps) (plus O(n eps^2)),
+//                 even with terms of mixed sign and magnitude.
+//   Pairwise     the terms are summed as a balanced binary tree, for O(eps log n).
+//                 Cheaper than Compensated, and nearly as good for long sums.
+//
+// Each result depends only on the sequence of terms, so a sum is bitwise reproducible as
+//  long as the same terms arrive in the same order.
+enum class SummationMethod { Naive, Compensated, Pairwise };
+
+// A running sum with the strategy chosen at runtime.
+// Small and allocation-free, so that one can be kept per output value.
+template <class T>
+class Accumulator {
+	public:
+		explicit Accumulator (SummationMethod method = SummationMethod::Naive)
+		: _method(method)
+		{ }
+
+		void add (T x) { add(&x, 1); }
+
+		// add() for each of terms[0..n), in order (with the strategy chosen once, up front)
+		void add (const T * terms, std::size_t n)
+		{
+			switch (_method) {
+			case SummationMethod::Naive:
+				for (std::size_t i=0; i < n; i++)
+					_sum += terms[i];
+				break;
+
+			case SummationMethod::Compensated:
+				for (std::size_t i=0; i < n; i++) {
+					T x = terms[i];
+					T t = _sum + x;
+					bool sum_larger = std::fabs(_sum) >= std::fabs(x);
+					T big   = sum_larger? _sum : x;
+					T small = sum_larger? x : _sum;
+					_carry += (big - t) + small;
+					_sum = t;
+				}
+				break;
+
+			case SummationMethod::Pairwise:
+				// runs of BLOCK terms are summed directly (where the tree would gain little),
+				//  and then merged like a binary counter, each level holding the sum of
+				//  2^level blocks
+				for (std::size_t i=0; i < n; i++) {
+					_sum += terms[i];
+					if (++_in_block == BLOCK)
+						push_block();
+				}
+				break;
+			}
+		}
+
+		T result () const
+		{
+			switch (_method) {
+			case SummationMethod::Compensated:
+				return _sum + _carry;
+
+			case SummationMethod::Pairwise: {
+				// the partial block, then the levels from the smallest up
+				T s = _sum;
+				std::size_t n = _blocks;
+				for (int level=0; n != 0; n >>= 1, level++)
+					if (n & 1)
+						s = _levels[level] + s;
+				return s;
+			}
+
+			default:
+				return _sum;
+			}
+		}
+
+		SummationMethod method () const { return _method; }
+
+	private:
+		static const std::size_t BLOCK = 8;
+
+		void push_block ()
+		{
+			T s = _sum;
+			std::size_t n = _blocks;
+			int level = 0;
+			for (; n & 1; n >>= 1, level++)
+				s = _levels[level] + s;
+			_levels[level] = s;
+			_blocks++;
+			_sum = 0;
+			_in_block = 0;
+		}
+
+		SummationMethod _method;
+		T _sum = 0;
+		T _carry = 0;                   // (Compensated)
+		std::size_t _in_block = 0;      // (Pairwise)
+		std::size_t _blocks = 0;
+		std::array<T, 64> _levels;
+};
+
+template <class T> const std::size_t Accumulator<T>::BLOCK;